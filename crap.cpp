@@ -1,11 +1,15 @@
 
 #include <cassert>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
 
 #include "rap.hpp"
 #include "rap_conn.hpp"
 #include "rap_frame.h"
+#include "rap_framepool.hpp"
 #include "rap_muxer.hpp"
+#include "rap_trace.hpp"
 
 /* crap.h must be included after rap.hpp */
 #include "crap.h"
@@ -22,6 +26,21 @@ extern "C" int rap_muxer_recv(rap_muxer* muxer, const char* buf, int bytes_trans
     return muxer->recv(buf, bytes_transferred);
 }
 
+extern "C" void rap_muxer_set_writev_cb(rap_muxer* muxer, rap_muxer_writev_cb_t muxer_writev_cb)
+{
+    muxer->set_writev_cb(muxer_writev_cb);
+}
+
+extern "C" void rap_muxer_cork(rap_muxer* muxer)
+{
+    muxer->cork();
+}
+
+extern "C" int rap_muxer_uncork(rap_muxer* muxer)
+{
+    return muxer->uncork();
+}
+
 extern "C" rap_conn* rap_muxer_get_conn(rap_muxer* muxer, int id)
 {
     return muxer->get_conn(static_cast<rap_conn_id>(id));
@@ -33,6 +52,93 @@ extern "C" void rap_muxer_destroy(rap_muxer* muxer)
         delete muxer;
 }
 
+extern "C" int rap_muxer_set_send_window(rap_muxer* muxer, int min_frames, int max_frames, int max_bytes)
+{
+    if (min_frames < 1 || max_frames < min_frames || max_frames > rap_max_send_window_limit || max_bytes < 1)
+        return rap::rap_err_invalid_parameter;
+    rap::window_limits limits;
+    limits.min_frames = min_frames;
+    limits.max_frames = max_frames;
+    limits.max_bytes = static_cast<size_t>(max_bytes);
+    muxer->set_window_limits(limits);
+    return rap::rap_err_ok;
+}
+
+extern "C" int rap_muxer_set_link_window(rap_muxer* muxer, int max_bytes)
+{
+    if (max_bytes < 0)
+        return rap::rap_err_invalid_parameter;
+    muxer->set_link_window(static_cast<size_t>(max_bytes));
+    return rap::rap_err_ok;
+}
+
+extern "C" int rap_muxer_define_string(rap_muxer* muxer, const char* str, int len)
+{
+    if (!str || len < 0)
+        return 0;
+    return static_cast<int>(muxer->define_string(str, static_cast<size_t>(len)));
+}
+
+extern "C" int rap_muxer_define_route(rap_muxer* muxer, const char* tmpl, int len)
+{
+    if (!tmpl || len < 0)
+        return 0;
+    return muxer->define_route(tmpl, static_cast<size_t>(len));
+}
+
+extern "C" rap_tracer* rap_tracer_create(const char* path, size_t capacity, size_t snaplen)
+{
+#if RAP_TRACE
+    if (!path)
+        return nullptr;
+    rap::tracer* t = new rap::tracer();
+    if (int err = t->open(path, capacity, snaplen)) {
+        delete t;
+        errno = -err;
+        return nullptr;
+    }
+    return t;
+#else
+    (void)path;
+    (void)capacity;
+    (void)snaplen;
+    return nullptr;
+#endif
+}
+
+extern "C" void rap_tracer_destroy(rap_tracer* tracer)
+{
+#if RAP_TRACE
+    delete tracer;
+#else
+    (void)tracer;
+#endif
+}
+
+extern "C" void rap_muxer_set_tracer(rap_muxer* muxer, rap_tracer* tracer, unsigned int link_id)
+{
+#if RAP_TRACE
+    muxer->set_tracer(tracer, static_cast<uint32_t>(link_id));
+#else
+    (void)muxer;
+    (void)tracer;
+    (void)link_id;
+#endif
+}
+
+extern "C" int rap_muxer_set_string_budget(rap_muxer* muxer, int max_bytes)
+{
+    if (max_bytes < 0)
+        return rap::rap_err_invalid_parameter;
+    muxer->set_string_budget(static_cast<size_t>(max_bytes));
+    return rap::rap_err_ok;
+}
+
+extern "C" int rap_muxer_send_setup(rap_muxer* muxer)
+{
+    return muxer->send_setup();
+}
+
 /*
  * Connection API
  */
@@ -61,20 +167,257 @@ int rap_conn_write_frame(rap_conn* conn, const rap_frame* f)
     return conn->write_frame(f);
 }
 
-rap_frame* rap_frame_create(int payload_max_size);
-void rap_frame_destroy(rap_frame* f)
+extern "C" int rap_conn_is_idle(rap_conn* conn)
+{
+    return conn->idle() ? 1 : 0;
+}
+
+extern "C" int rap_conn_write_shared(rap_conn* conn, const rap_frame* f)
+{
+    if (!f)
+        return rap::rap_err_invalid_parameter;
+    return conn->write_shared(f);
+}
+
+int rap_conn_set_priority(rap_conn* conn, int priority, int weight)
 {
-    if (f)
-        delete reinterpret_cast<std::vector<char>*>(f);
+    return conn->set_priority(priority, weight);
 }
-rap_conn_id rap_frame_id(const rap_frame* f)
+
+extern "C" rap_frame* rap_frame_create(int payload_max_size)
+{
+    if (payload_max_size < 0)
+        return nullptr;
+    return rap::framepool::create(static_cast<size_t>(payload_max_size));
+}
+
+extern "C" rap_frame* rap_frame_retain(rap_frame* f)
+{
+    return f ? rap::framepool::retain(f) : nullptr;
+}
+
+extern "C" void rap_frame_destroy(rap_frame* f)
+{
+    rap::framepool::destroy(f);
+}
+
+extern "C" rap_conn_id rap_frame_id(const rap_frame* f)
 {
     return f->header().id();
 }
-size_t rap_frame_needed_bytes(const char*);
-int rap_frame_payload_max_size(const rap_frame*);
-const char* rap_frame_payload_start(const rap_frame*);
-char* rap_frame_payload_current(const rap_frame*);
-const char* rap_frame_payload_limit(const rap_frame*);
-int rap_frame_copy(rap_frame* dst, const rap_frame* src);
-int rap_frame_error(const rap_frame*);
+
+extern "C" size_t rap_frame_needed_bytes(const char* src_ptr)
+{
+    return rap_frame::needed_bytes(src_ptr);
+}
+
+extern "C" int rap_frame_payload_max_size(const rap_frame* f)
+{
+    return static_cast<int>(rap::framepool::block::of(f)->limit);
+}
+
+extern "C" const char* rap_frame_payload_start(const rap_frame* f)
+{
+    return f->payload();
+}
+
+extern "C" char* rap_frame_payload_current(const rap_frame* f)
+{
+    return rap::framepool::block::of(f)->cur;
+}
+
+extern "C" const char* rap_frame_payload_limit(const rap_frame* f)
+{
+    return f->payload() + rap::framepool::block::of(f)->limit;
+}
+
+extern "C" int rap_frame_copy(rap_frame* dst, const rap_frame* src)
+{
+    if (!dst || !src)
+        return rap::rap_err_invalid_parameter;
+    rap::framepool::block* b = rap::framepool::block::of(dst);
+    if (src->payload_size() > b->limit)
+        return rap::rap_err_payload_too_big;
+    memcpy(dst, src, src->size());
+    b->cur = dst->payload() + dst->payload_size();
+    b->error = rap::rap_err_ok;
+    return rap::rap_err_ok;
+}
+
+extern "C" int rap_frame_error(const rap_frame* f)
+{
+    return rap::framepool::block::of(f)->error;
+}
+
+// appends to the payload of a frame from rap_frame_create()
+static int frame_append(rap_frame* f, const char* src_ptr, size_t src_len)
+{
+    rap::framepool::block* b = rap::framepool::block::of(f);
+    if (b->error)
+        return -b->error;
+    if (b->cur + src_len > f->payload() + b->limit) {
+        b->error = rap::rap_err_output_buffer_too_small;
+        return -b->error;
+    }
+    memcpy(b->cur, src_ptr, src_len);
+    b->cur += src_len;
+    f->header().set_size_value(static_cast<size_t>(b->cur - f->payload()));
+    return static_cast<int>(src_len);
+}
+
+static char* put_uint64(char* p, uint64_t n)
+{
+    while (n >= 0x80) {
+        *p++ = static_cast<char>((n & 0x7f) | 0x80);
+        n >>= 7;
+    }
+    *p++ = static_cast<char>(n);
+    return p;
+}
+
+extern "C" int rap_frame_write_tag(rap_frame* f, rap_tag tag)
+{
+    return frame_append(f, &tag, 1);
+}
+
+extern "C" int rap_frame_write_uint64(rap_frame* f, uint64_t n)
+{
+    char buf[10];
+    return frame_append(f, buf, static_cast<size_t>(put_uint64(buf, n) - buf));
+}
+
+extern "C" int rap_frame_write_int64(rap_frame* f, int64_t n)
+{
+    uint64_t ux = static_cast<uint64_t>(n) << 1;
+    if (n < 0)
+        ux = ~ux;
+    return rap_frame_write_uint64(f, ux);
+}
+
+extern "C" int rap_frame_write_length(rap_frame* f, int n)
+{
+    char buf[2];
+    if (n < 0)
+        return -rap::rap_err_invalid_parameter;
+    if (n < 0x80) {
+        buf[0] = static_cast<char>(n);
+        return frame_append(f, buf, 1);
+    }
+    if (n < 0x8000) {
+        buf[0] = static_cast<char>((n >> 8) | 0x80);
+        buf[1] = static_cast<char>(n);
+        return frame_append(f, buf, 2);
+    }
+    return -rap::rap_err_string_too_long;
+}
+
+extern "C" int rap_frame_write_string(rap_frame* f, const char* str, int len)
+{
+    char buf[2];
+    if (len < 0)
+        return -rap::rap_err_invalid_parameter;
+    if (!len) {
+        buf[0] = 0;
+        buf[1] = str ? 1 : 0;
+        return frame_append(f, buf, 2);
+    }
+    if (unsigned key = rap_textmap_to_key(str, static_cast<size_t>(len))) {
+        buf[0] = 0;
+        buf[1] = static_cast<char>(key);
+        return frame_append(f, buf, 2);
+    }
+    rap::framepool::block* b = rap::framepool::block::of(f);
+    char* start = b->cur;
+    int n = rap_frame_write_length(f, len);
+    if (n < 0)
+        return n;
+    int m = frame_append(f, str, static_cast<size_t>(len));
+    if (m < 0) {
+        // don't leave a dangling length behind
+        b->cur = start;
+        f->header().set_size_value(static_cast<size_t>(b->cur - f->payload()));
+        return m;
+    }
+    return n + m;
+}
+
+/*
+ * Frame parsing API
+ */
+
+extern "C" int rap_parse_tag(const char** pp, rap_tag* result)
+{
+    if (!pp || !*pp || !result)
+        return -rap::rap_err_invalid_parameter;
+    *result = *(*pp)++;
+    return 1;
+}
+
+extern "C" int rap_parse_uint64(const char** pp, uint64_t* result)
+{
+    if (!pp || !*pp || !result)
+        return -rap::rap_err_invalid_parameter;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(*pp);
+    uint64_t accum = 0;
+    for (int i = 0; i < 10; ++i) {
+        unsigned char uch = p[i];
+        accum |= uint64_t(uch & 0x7f) << (i * 7);
+        if (uch < 0x80) {
+            *result = accum;
+            *pp += i + 1;
+            return i + 1;
+        }
+    }
+    return -rap::rap_err_incomplete_number;
+}
+
+extern "C" int rap_parse_int64(const char** pp, int64_t* result)
+{
+    uint64_t ux;
+    int n = rap_parse_uint64(pp, &ux);
+    if (n > 0) {
+        int64_t ix = static_cast<int64_t>(ux >> 1);
+        if (ux & 1)
+            ix = ~ix;
+        *result = ix;
+    }
+    return n;
+}
+
+extern "C" int rap_parse_length(const char** pp, int* result)
+{
+    if (!pp || !*pp || !result)
+        return -rap::rap_err_invalid_parameter;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(*pp);
+    if (p[0] < 0x80) {
+        *result = p[0];
+        *pp += 1;
+        return 1;
+    }
+    *result = ((p[0] & 0x7f) << 8) | p[1];
+    *pp += 2;
+    return 2;
+}
+
+extern "C" int rap_parse_string(const char** pp, const char** result, int* result_len)
+{
+    if (!result || !result_len)
+        return -rap::rap_err_invalid_parameter;
+    int len;
+    int n = rap_parse_length(pp, &len);
+    if (n < 0)
+        return n;
+    if (len) {
+        *result = *pp;
+        *result_len = len;
+        *pp += len;
+        return n + len;
+    }
+    unsigned char key = static_cast<unsigned char>(*(*pp)++);
+    rap::text txt(key);
+    if (txt.is_null() && key != 0)
+        return -rap::rap_err_string_index_unknown;
+    *result = txt.data();
+    *result_len = static_cast<int>(txt.size());
+    return n + 1;
+}
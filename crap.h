@@ -26,6 +26,11 @@ typedef void rap_muxer;
 typedef void rap_conn;
 #endif
 
+#ifndef RAP_TRACER_DEFINED
+#define RAP_TRACER_DEFINED 1
+typedef void rap_tracer;
+#endif
+
 #ifndef RAP_PARSER_DEFINED
 #define RAP_PARSER_DEFINED 1
 typedef void rap_parser;
@@ -67,6 +72,92 @@ rap_muxer* rap_muxer_create(void* muxer_user_data, rap_muxer_write_cb_t muxer_wr
 int rap_muxer_recv(rap_muxer* muxer, const char* buf, int len);
 void rap_muxer_destroy(rap_muxer* muxer);
 
+/*
+* Returns the connection with the given ID, initializing it on first use.
+* Clients use this to pick the connection a request is sent on. Once both
+* sides have sent a final frame on a connection, it can carry a new request.
+*/
+rap_conn* rap_muxer_get_conn(rap_muxer* muxer, int id);
+
+/*
+* Output corking
+*
+* While a muxer is processing a `rap_muxer_recv()` call, all frames written
+* by its connections are collected and written out once at the end. If a
+* vectored write callback is set with `rap_muxer_set_writev_cb()`, it
+* receives the collected output in a single call, otherwise the
+* `muxer_write_cb` is called.
+* 
+* To get the same batching for frames written outside of `rap_muxer_recv()`,
+* surround the writes with `rap_muxer_cork()` and `rap_muxer_uncork()`.
+* These must be called from the same thread that writes the frames.
+*/
+
+void rap_muxer_set_writev_cb(rap_muxer* muxer, rap_muxer_writev_cb_t muxer_writev_cb);
+void rap_muxer_cork(rap_muxer* muxer);
+int rap_muxer_uncork(rap_muxer* muxer);
+
+/*
+* Send window negotiation
+*
+* Each connection adapts its send window to the measured ACK round-trip
+* time, within the bounds set by `rap_muxer_set_send_window()`. The upper
+* bound is also limited by what the peer advertises in its setup frame.
+* Until a setup frame is exchanged the window is `rap_max_send_window`.
+* 
+* `rap_muxer_send_setup()` advertises the local upper bound to the peer,
+* which answers with its own.
+* 
+* The setup frame also carries the link window, the number of frame bytes
+* the peer may have in flight over all connections of the link. Set it
+* with `rap_muxer_set_link_window()`, zero disabling the limit. The
+* receiver grants more credit on the muxer connection as it processes
+* frames, which bounds the memory a link can demand. Frames sent before
+* the setup frame arrives, or before a later one, count against it too.
+*/
+
+int rap_muxer_set_send_window(rap_muxer* muxer, int min_frames, int max_frames, int max_bytes);
+int rap_muxer_set_link_window(rap_muxer* muxer, int max_bytes);
+int rap_muxer_send_setup(rap_muxer* muxer);
+
+/*
+* Defines a string for the peer so that it is sent as a single key byte
+* from then on, returning the key or zero if it can't be defined. The
+* strings defined for a peer are limited to `rap_string_table_size`
+* bytes by default, the oldest being replaced first once no connection
+* has frames queued.
+*/
+int rap_muxer_define_string(rap_muxer* muxer, const char* str, int len);
+int rap_muxer_set_string_budget(rap_muxer* muxer, int max_bytes);
+
+/*
+* Defines a route template for the peer, where each "{}" stands for a
+* parameter, returning its index or zero if the table is full. Requests
+* can then send the index and the parameters instead of the path, and
+* the receiver can dispatch on the index.
+*/
+int rap_muxer_define_route(rap_muxer* muxer, const char* tmpl, int len);
+
+/*
+* Wire tracing
+*
+* A `rap_tracer` records the frames read and written by the muxers it is
+* set on into a ring in a memory mapped file at `path`, each entry with a
+* timestamp, the direction and a link number. At most `snaplen` bytes are
+* kept per entry, zero keeping everything. Muxers on different threads may
+* share a tracer. Decode the file with `craptrace`.
+* 
+* `rap_tracer_create()` returns NULL if the file can't be set up, or if
+* the library was built with RAP_TRACE defined to 0.
+* 
+* `rap_muxer_set_tracer()` starts tracing the muxer, tagging its frames
+* with `link_id`, or stops it if `tracer` is NULL. It must be called from
+* the thread using the muxer, and the tracer must outlive the muxer.
+*/
+rap_tracer* rap_tracer_create(const char* path, size_t capacity, size_t snaplen);
+void rap_tracer_destroy(rap_tracer* tracer);
+void rap_muxer_set_tracer(rap_muxer* muxer, rap_tracer* tracer, unsigned int link_id);
+
 /*
 * Connection API
 */
@@ -79,10 +170,42 @@ int rap_conn_get_callback(const rap_conn* conn,
     void** p_conn_cb_param);
 int rap_conn_write_frame(rap_conn* conn, const rap_frame* f);
 
+/*
+* Returns 1 if no frames written to the connection are waiting for its send
+* window or the link credit, else 0. A writer that stops while it returns 0
+* holds no more than one batch of frames in the queue.
+*/
+int rap_conn_is_idle(rap_conn* conn);
+
+/*
+* Queues a frame from `rap_frame_create()` by reference instead of copying
+* it, using the connection's id in place of the one in the frame. The same
+* frame may be written to any number of connections this way, but must not
+* be modified afterwards. The caller keeps its own reference.
+*/
+int rap_conn_write_shared(rap_conn* conn, const rap_frame* f);
+
+/*
+* Sets the output priority level of the connection, from 0 (highest) to
+* `rap_max_priority`, and its share of the link bandwidth relative to
+* other connections on the same level. Defaults are 0 and 1.
+*/
+int rap_conn_set_priority(rap_conn* conn, int priority, int weight);
+
 /*
 * Frame API
+*
+* Frames from `rap_frame_create()` come from a pool with per-thread caches
+* and must be released with `rap_frame_destroy()`, which may be called from
+* any thread. The payload pointer and error functions only apply to such
+* frames. Writing to a frame keeps its header size up to date.
+* 
+* Such frames are reference counted. `rap_frame_retain()` adds a reference
+* and `rap_frame_destroy()` drops one. To keep a frame received in a
+* connection callback, copy it into a created frame with `rap_frame_copy()`.
 */
 rap_frame* rap_frame_create(int payload_max_size);
+rap_frame* rap_frame_retain(rap_frame*);
 void rap_frame_destroy(rap_frame*);
 rap_conn_id rap_frame_id(const rap_frame*);
 size_t rap_frame_needed_bytes(const char*);
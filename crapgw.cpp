@@ -0,0 +1,830 @@
+/**
+ * @brief REST Aggregation Protocol HTTP/1.1 gateway
+ *
+ * Accepts HTTP/1.1 clients and forwards their requests over a small
+ * pool of RAP links to an upstream server such as crapper, streaming
+ * the responses back. Each request in flight uses a free connection ID
+ * on the least loaded link, and the ID is reused once both sides have
+ * sent their final frame.
+ *
+ * Usage: crapgw [listen-port [upstream-host [upstream-port [links]]]]
+ */
+
+#include <boost/asio.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rap.hpp"
+#include "rap_conn.hpp"
+#include "rap_http.hpp"
+#include "rap_muxer.hpp"
+#include "rap_reader.hpp"
+#include "rap_response.hpp"
+#include "rap_stats.hpp"
+#include "rap_writer.hpp"
+
+/* crap.h must be included after rap.hpp */
+#include "crap.h"
+
+#define PRINT_STREAM stderr
+
+using boost::asio::ip::tcp;
+
+class client;
+
+/*
+ * upstream is one RAP link to the upstream server.
+ */
+class upstream : public std::enable_shared_from_this<upstream> {
+public:
+    upstream(boost::asio::io_service& io_service, const tcp::endpoint& endpoint)
+        : io_service_(io_service)
+        , endpoint_(endpoint)
+        , socket_(io_service)
+        , timer_(io_service)
+        , muxer_(nullptr)
+        , connected_(false)
+        , in_flight_(0)
+    {
+    }
+
+    ~upstream() { reset(); }
+
+    void start() { do_connect(); }
+
+    bool connected() const { return connected_; }
+    size_t in_flight() const { return in_flight_; }
+    bool can_acquire() const { return connected_ && !free_ids_.empty(); }
+
+    /*
+     * Takes a free connection for an exchange with @a owner, which is kept
+     * alive until the exchange ends with release().
+     */
+    rap_conn* acquire(const std::shared_ptr<client>& owner)
+    {
+        assert(can_acquire());
+        rap_conn_id id = free_ids_.back();
+        free_ids_.pop_back();
+        owners_[id] = owner;
+        ++in_flight_;
+        return rap_muxer_get_conn(muxer_, id);
+    }
+
+    void release(rap_conn_id id)
+    {
+        assert(owners_[id]);
+        owners_[id].reset();
+        free_ids_.push_back(id);
+        --in_flight_;
+    }
+
+    /*
+     * Holds back the owner of connection @a id until the frames queued on
+     * it have been sent, see client::unblocked().
+     */
+    void block(rap_conn_id id) { blocked_.push_back(id); }
+
+    rap_muxer* muxer() const { return muxer_; }
+
+private:
+    enum {
+        max_length = 0x10000
+    };
+
+    boost::asio::io_service& io_service_;
+    tcp::endpoint endpoint_;
+    tcp::socket socket_;
+    boost::asio::deadline_timer timer_;
+    rap_muxer* muxer_;
+    bool connected_;
+    size_t in_flight_;
+    std::vector<rap_conn_id> free_ids_;
+    std::vector<std::shared_ptr<client>> owners_;
+    std::vector<rap_conn_id> blocked_;
+    std::vector<char> buf_towrite_;
+    std::vector<char> buf_writing_;
+    char data_[max_length];
+
+    static int s_write_cb(void* self, const char* src_ptr, int src_len)
+    {
+        return static_cast<upstream*>(self)->write_cb(src_ptr, src_len);
+    }
+
+    static int s_writev_cb(void* self, const rap_iovec* iov, int iovcnt)
+    {
+        upstream* up = static_cast<upstream*>(self);
+        for (int i = 0; i < iovcnt; ++i) {
+            const char* src_ptr = static_cast<const char*>(iov[i].iov_base);
+            up->buf_towrite_.insert(up->buf_towrite_.end(), src_ptr, src_ptr + iov[i].iov_len);
+        }
+        up->write_some();
+        return up->connected_ ? 0 : -1;
+    }
+
+    int write_cb(const char* src_ptr, int src_len)
+    {
+        buf_towrite_.insert(buf_towrite_.end(), src_ptr, src_ptr + src_len);
+        write_some();
+        return connected_ ? 0 : -1;
+    }
+
+    void do_connect()
+    {
+        auto self(shared_from_this());
+        socket_.async_connect(endpoint_, [this, self](boost::system::error_code ec) {
+            if (ec) {
+                fprintf(PRINT_STREAM, "crapgw::upstream::connect(%s)\n", ec.message().c_str());
+                retry();
+                return;
+            }
+            socket_.set_option(tcp::no_delay(true));
+            muxer_ = rap_muxer_create(this, s_write_cb, nullptr);
+            rap_muxer_set_writev_cb(muxer_, s_writev_cb);
+            free_ids_.clear();
+            for (int id = rap_max_conn_id; id >= 0; --id)
+                free_ids_.push_back(static_cast<rap_conn_id>(id));
+            owners_.assign(rap_max_conn_id + 1, std::shared_ptr<client>());
+            blocked_.clear();
+            in_flight_ = 0;
+            connected_ = true;
+            rap_muxer_send_setup(muxer_);
+            read_stream();
+        });
+    }
+
+    void retry()
+    {
+        auto self(shared_from_this());
+        timer_.expires_from_now(boost::posix_time::seconds(1));
+        timer_.async_wait([this, self](const boost::system::error_code& ec) {
+            if (!ec)
+                do_connect();
+        });
+    }
+
+    void write_some()
+    {
+        if (!connected_ || !buf_writing_.empty() || buf_towrite_.empty())
+            return;
+        buf_writing_.swap(buf_towrite_);
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_, boost::asio::buffer(buf_writing_),
+            [this, self](boost::system::error_code ec, std::size_t) {
+                buf_writing_.clear();
+                if (ec) {
+                    fail(ec);
+                    return;
+                }
+                write_some();
+            });
+    }
+
+    void read_stream()
+    {
+        auto self(shared_from_this());
+        socket_.async_read_some(boost::asio::buffer(data_, max_length),
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                if (ec) {
+                    fail(ec);
+                    return;
+                }
+                int rap_ec = rap_muxer_recv(muxer_, data_, static_cast<int>(length));
+                if (rap_ec < 0) {
+                    fprintf(PRINT_STREAM, "crapgw::upstream::read_stream(): rap error %d\n", rap_ec);
+                    fail(boost::asio::error::invalid_argument);
+                    return;
+                }
+                unblock();
+                read_stream();
+            });
+    }
+
+    void unblock();
+    void fail(const boost::system::error_code& ec);
+
+    void reset()
+    {
+        connected_ = false;
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+        buf_towrite_.clear();
+        if (muxer_) {
+            rap_muxer_destroy(muxer_);
+            muxer_ = nullptr;
+        }
+    }
+};
+
+/*
+ * client is an HTTP/1.1 connection from a client. It handles one request
+ * at a time, reading the next one once the response has been sent.
+ */
+class client : public std::enable_shared_from_this<client> {
+public:
+    client(boost::asio::io_service& io_service, tcp::socket socket,
+        std::vector<std::shared_ptr<upstream>>& upstreams, rap::stats& stats)
+        : io_service_(io_service)
+        , socket_(std::move(socket))
+        , upstreams_(upstreams)
+        , stats_(stats)
+        , in_(0x4000)
+        , in_begin_(0)
+        , in_end_(0)
+        , scan_(0)
+        , frame_(rap_frame_max_size)
+        , up_(nullptr)
+        , conn_(nullptr)
+        , body_left_(0)
+        , blocked_(false)
+        , sent_final_(false)
+        , got_final_(false)
+        , got_head_(false)
+        , chunked_(false)
+        , head_request_(false)
+        , http10_(false)
+        , keep_alive_(true)
+        , closed_(false)
+    {
+    }
+
+    void start() { read_some(); }
+
+    // the frames queued on the upstream connection have been sent
+    void unblocked()
+    {
+        if (!blocked_)
+            return;
+        blocked_ = false;
+        process();
+    }
+
+    // the link carrying the exchange is gone along with its connections
+    void upstream_lost()
+    {
+        conn_ = nullptr;
+        up_ = nullptr;
+        blocked_ = false;
+        keep_alive_ = false;
+        if (!got_head_)
+            write_error(502);
+        shutdown_after_flush();
+    }
+
+private:
+    enum {
+        max_head_size = 0x8000
+    };
+
+    boost::asio::io_service& io_service_;
+    tcp::socket socket_;
+    std::vector<std::shared_ptr<upstream>>& upstreams_;
+    rap::stats& stats_;
+    std::vector<char> in_;
+    size_t in_begin_;
+    size_t in_end_;
+    size_t scan_; // where to continue looking for the end of the head
+    std::vector<char> frame_;
+    std::string out_;
+    std::string writing_;
+    upstream* up_;
+    rap_conn* conn_;
+    int64_t body_left_;
+    bool blocked_; // waiting for the upstream connection to send its queue
+    bool sent_final_;
+    bool got_final_;
+    bool got_head_;
+    bool chunked_;
+    bool head_request_; // the response has no body
+    bool http10_; // the client can't take a chunked response
+    bool keep_alive_;
+    bool closed_;
+
+    bool in_exchange() const { return conn_ != nullptr; }
+
+    void read_some()
+    {
+        if (closed_)
+            return;
+        if (in_end_ == in_.size()) {
+            if (in_begin_ > 0) {
+                memmove(in_.data(), in_.data() + in_begin_, in_end_ - in_begin_);
+                in_end_ -= in_begin_;
+                scan_ -= in_begin_;
+                in_begin_ = 0;
+            } else {
+                in_.resize(in_.size() * 2);
+            }
+        }
+        auto self(shared_from_this());
+        socket_.async_read_some(boost::asio::buffer(in_.data() + in_end_, in_.size() - in_end_),
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                if (ec) {
+                    close();
+                    return;
+                }
+                stats_.add_bytes_read(length);
+                in_end_ += length;
+                process();
+            });
+    }
+
+    // handles buffered input, reading more when it runs out
+    void process()
+    {
+        if (closed_)
+            return;
+        if (in_exchange()) {
+            if (body_left_ > 0 && !forward_body())
+                return;
+            if (!sent_final_)
+                send_final();
+            return; // reading resumes once the response is done
+        }
+        if (in_begin_ == in_end_) {
+            in_begin_ = in_end_ = scan_ = 0;
+            read_some();
+            return;
+        }
+        const char* head = in_.data() + in_begin_;
+        const char* end = find_head_end(head, in_.data() + in_end_);
+        if (end == nullptr) {
+            scan_ = in_end_ > in_begin_ + 3 ? in_end_ - 3 : in_begin_;
+            if (in_end_ - in_begin_ > max_head_size)
+                return fail_request(431);
+            read_some();
+            return;
+        }
+        in_begin_ = static_cast<size_t>(end - in_.data());
+        scan_ = in_begin_;
+        start_request(head, end);
+    }
+
+    const char* find_head_end(const char* head, const char* end) const
+    {
+        const char* p = in_.data() + scan_;
+        if (p < head)
+            p = head;
+        while (end - p >= 4) {
+            const char* cr = static_cast<const char*>(memchr(p, '\r', static_cast<size_t>(end - p - 3)));
+            if (cr == nullptr)
+                break;
+            if (cr[1] == '\n' && cr[2] == '\r' && cr[3] == '\n')
+                return cr + 4;
+            p = cr + 1;
+        }
+        return nullptr;
+    }
+
+    static bool iequals(const rap::text& t, const char* c_str)
+    {
+        size_t n = strlen(c_str);
+        if (t.size() != n)
+            return false;
+        for (size_t i = 0; i < n; ++i)
+            if ((t.data()[i] | 0x20) != (c_str[i] | 0x20))
+                return false;
+        return true;
+    }
+
+    static rap::text trim(const char* p, const char* end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            ++p;
+        while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+            --end;
+        return rap::text(p, static_cast<size_t>(end - p));
+    }
+
+    // parses the head in [p, end) without copying and sends it upstream
+    void start_request(const char* p, const char* end)
+    {
+        end -= 2; // the final CRLF
+        const char* eol = static_cast<const char*>(memchr(p, '\r', static_cast<size_t>(end - p)));
+        const char* sp1 = static_cast<const char*>(memchr(p, ' ', static_cast<size_t>(eol - p)));
+        const char* sp2 = sp1 ? static_cast<const char*>(memchr(sp1 + 1, ' ', static_cast<size_t>(eol - sp1 - 1))) : nullptr;
+        if (sp1 == nullptr || sp2 == nullptr || sp1 == p || sp2 == sp1 + 1)
+            return fail_request(400);
+        rap::text method(p, static_cast<size_t>(sp1 - p));
+        rap::text target(sp1 + 1, static_cast<size_t>(sp2 - sp1 - 1));
+        rap::text version(sp2 + 1, static_cast<size_t>(eol - sp2 - 1));
+        if (version == "HTTP/1.1")
+            keep_alive_ = true;
+        else if (version == "HTTP/1.0")
+            keep_alive_ = false;
+        else
+            return fail_request(505);
+        http10_ = !keep_alive_;
+        head_request_ = method == "HEAD";
+
+        upstream* up = pick_upstream();
+        if (up == nullptr)
+            return fail_request(503);
+
+        rap_frame* f = reinterpret_cast<rap_frame*>(frame_.data());
+        char* start = f->payload();
+        rap::span_writer w(start, start + rap_frame_max_payload_size);
+        const char* path_end = static_cast<const char*>(memchr(target.data(), '?', target.size()));
+        if (path_end == nullptr)
+            path_end = target.data() + target.size();
+        // writes that don't fit leave nothing behind, so check once at the end
+        int failed = 0;
+        char tag = rap::record::tag_http_request;
+        failed |= w.write(&tag, 1);
+        failed |= w.write_text(method.data(), method.size());
+        failed |= w.write_text("http", 4);
+        failed |= w.write_length(0);
+        failed |= w.write_text(target.data(), static_cast<size_t>(path_end - target.data()));
+        failed |= write_query(w, path_end, target.data() + target.size());
+
+        rap::text host;
+        int64_t content_length = -1;
+        for (p = eol + 2; p < end;) {
+            eol = static_cast<const char*>(memchr(p, '\r', static_cast<size_t>(end - p)));
+            if (eol == nullptr)
+                eol = end;
+            const char* colon = static_cast<const char*>(memchr(p, ':', static_cast<size_t>(eol - p)));
+            if (colon == nullptr || colon == p)
+                return fail_request(400);
+            rap::text name(p, static_cast<size_t>(colon - p));
+            rap::text value(trim(colon + 1, eol));
+            p = eol + 2;
+            if (iequals(name, "host")) {
+                host = value;
+            } else if (iequals(name, "content-length")) {
+                if ((content_length = parse_length(value)) < 0)
+                    return fail_request(400);
+            } else if (iequals(name, "transfer-encoding")) {
+                return fail_request(411);
+            } else if (iequals(name, "connection")) {
+                if (iequals(value, "close"))
+                    keep_alive_ = false;
+                else if (iequals(value, "keep-alive"))
+                    keep_alive_ = true;
+            } else if (!iequals(name, "keep-alive")) {
+                failed |= w.write_header_name(name.data(), name.size());
+                failed |= w.write_text(value.data(), value.size());
+                failed |= w.write_text(nullptr, 0);
+            }
+        }
+        failed |= w.write_text(nullptr, 0);
+        if (host.is_null())
+            host = rap::text("", 0);
+        failed |= w.write_text(host.data(), host.size());
+        failed |= w.write_int64(content_length);
+        if (failed)
+            return fail_request(431);
+
+        up_ = up;
+        conn_ = up->acquire(shared_from_this());
+        rap_conn_set_callback(conn_, s_conn_cb, this);
+        sent_final_ = got_final_ = got_head_ = chunked_ = false;
+        body_left_ = content_length > 0 ? content_length : 0;
+        stats_.head_count++;
+
+        f->header() = rap_header(rap_conn_get_id(conn_));
+        f->header().set_head();
+        f->header().set_size_value(static_cast<size_t>(w.data() - start));
+        rap_muxer_cork(up_->muxer());
+        rap_conn_write_frame(conn_, f);
+        process();
+        rap_muxer_uncork(up_->muxer());
+        if (blocked_ && rap_conn_is_idle(conn_))
+            unblocked(); // only the cork held the frames back
+    }
+
+    // writes the query string [p, end) as a kvv with one value per key
+    static int write_query(rap::span_writer& w, const char* p, const char* end)
+    {
+        int failed = 0;
+        if (p < end)
+            ++p; // the '?'
+        while (p < end) {
+            const char* amp = static_cast<const char*>(memchr(p, '&', static_cast<size_t>(end - p)));
+            if (amp == nullptr)
+                amp = end;
+            if (amp > p) {
+                const char* eq = static_cast<const char*>(memchr(p, '=', static_cast<size_t>(amp - p)));
+                const char* key_end = eq ? eq : amp;
+                failed |= w.write_text(p, static_cast<size_t>(key_end - p));
+                if (eq)
+                    failed |= w.write_text(eq + 1, static_cast<size_t>(amp - eq - 1));
+                else
+                    failed |= w.write_text("", 0);
+                failed |= w.write_text(nullptr, 0);
+            }
+            p = amp + 1;
+        }
+        return failed | w.write_text(nullptr, 0);
+    }
+
+    // returns the decimal value of @a t, or -1
+    static int64_t parse_length(const rap::text& t)
+    {
+        if (t.empty() || t.size() > 15)
+            return -1;
+        int64_t n = 0;
+        for (size_t i = 0; i < t.size(); ++i) {
+            if (t.data()[i] < '0' || t.data()[i] > '9')
+                return -1;
+            n = n * 10 + (t.data()[i] - '0');
+        }
+        return n;
+    }
+
+    upstream* pick_upstream() const
+    {
+        upstream* best = nullptr;
+        for (size_t i = 0; i < upstreams_.size(); ++i) {
+            upstream* up = upstreams_[i].get();
+            if (up->can_acquire() && (best == nullptr || up->in_flight() < best->in_flight()))
+                best = up;
+        }
+        return best;
+    }
+
+    // forwards buffered body bytes, returning true once all are sent; more
+    // is only read once the connection has sent what it had queued, so at
+    // most one buffer of the body waits on the upstream window
+    bool forward_body()
+    {
+        rap_frame* f = reinterpret_cast<rap_frame*>(frame_.data());
+        while (body_left_ > 0 && in_begin_ < in_end_) {
+            size_t n = in_end_ - in_begin_;
+            if (n > static_cast<uint64_t>(body_left_))
+                n = static_cast<size_t>(body_left_);
+            if (n > rap_frame_max_payload_size)
+                n = rap_frame_max_payload_size;
+            f->header() = rap_header(rap_conn_get_id(conn_));
+            f->header().set_body();
+            f->header().set_size_value(n);
+            memcpy(f->payload(), in_.data() + in_begin_, n);
+            rap_conn_write_frame(conn_, f);
+            in_begin_ += n;
+            body_left_ -= static_cast<int64_t>(n);
+        }
+        if (body_left_ > 0) {
+            if (in_begin_ == in_end_)
+                in_begin_ = in_end_ = scan_ = 0;
+            if (!rap_conn_is_idle(conn_)) {
+                blocked_ = true;
+                up_->block(rap_conn_get_id(conn_));
+                return false;
+            }
+            read_some();
+            return false;
+        }
+        scan_ = in_begin_;
+        return true;
+    }
+
+    void send_final()
+    {
+        rap_header h(rap_conn_get_id(conn_));
+        h.set_final();
+        sent_final_ = true;
+        rap_conn_write_frame(conn_, reinterpret_cast<const rap_frame*>(&h));
+        if (got_final_)
+            end_exchange();
+    }
+
+    static int s_conn_cb(void* self, rap_conn* conn, const rap_frame* f, int len)
+    {
+        return static_cast<client*>(self)->conn_cb(conn, f, len);
+    }
+
+    int conn_cb(rap_conn* conn, const rap_frame* f, int)
+    {
+        const rap_header& hdr = f->header();
+        if (hdr.is_final()) {
+            if (chunked_ && !closed_)
+                out_.append("0\r\n\r\n", 5);
+            got_final_ = true;
+            flush();
+            if (sent_final_)
+                end_exchange();
+            return 0;
+        }
+        if (closed_)
+            return 0;
+        rap::reader r(f, &conn->strings(), &conn->routes());
+        if (hdr.has_head() && !got_head_) {
+            if (r.read_tag() != rap::record::tag_http_response)
+                return 0;
+            rap::response res(r);
+            if (r.error()) {
+                write_error(502);
+                keep_alive_ = false;
+                return 0;
+            }
+            got_head_ = true;
+            bool unknown_length = res.content_length() < 0 && rap::http::has_body(res.code());
+            chunked_ = unknown_length && !head_request_ && !http10_;
+            if (http10_) {
+                // the body, if any, ends when the connection closes
+                if (unknown_length && !head_request_)
+                    keep_alive_ = false;
+                rap::http::render_unframed(out_, res);
+            } else {
+                rap::http::render(out_, res);
+            }
+        }
+        if (hdr.has_body() && r.size() > 0 && !head_request_) {
+            if (chunked_) {
+                char line[rap::http::max_chunk_line];
+                out_.append(line, rap::http::put_chunk_size(line, r.size()));
+            }
+            out_.append(r.data(), r.size());
+            if (chunked_)
+                out_.append("\r\n", 2);
+        }
+        flush();
+        return 0;
+    }
+
+    // the exchange is over on both sides, so the RAP connection is free
+    void end_exchange()
+    {
+        if (conn_ == nullptr)
+            return;
+        rap_conn_set_callback(conn_, nullptr, nullptr);
+        rap_conn_id id = rap_conn_get_id(conn_);
+        upstream* up = up_;
+        conn_ = nullptr;
+        up_ = nullptr;
+        if (!keep_alive_)
+            shutdown_after_flush();
+        else {
+            auto self(shared_from_this());
+            io_service_.post([self]() { self->process(); });
+        }
+        up->release(id); // may drop the last reference to us
+    }
+
+    void fail_request(int code)
+    {
+        write_error(code);
+        keep_alive_ = false;
+        shutdown_after_flush();
+    }
+
+    void write_error(int code)
+    {
+        rap::response res(static_cast<uint16_t>(code), 0);
+        rap::http::render(out_, res);
+        got_head_ = true;
+        flush();
+    }
+
+    void flush()
+    {
+        if (closed_ || !writing_.empty() || out_.empty())
+            return;
+        writing_.swap(out_);
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_, boost::asio::buffer(writing_),
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                writing_.clear();
+                if (ec) {
+                    close();
+                    return;
+                }
+                stats_.add_bytes_written(length);
+                if (!out_.empty())
+                    flush();
+                else if (!keep_alive_ && !in_exchange())
+                    close();
+            });
+    }
+
+    void shutdown_after_flush()
+    {
+        if (writing_.empty() && out_.empty())
+            close();
+        else
+            flush();
+    }
+
+    void close()
+    {
+        if (closed_)
+            return;
+        closed_ = true;
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+        // let the upstream finish the exchange, it keeps us alive until then
+        if (in_exchange() && !sent_final_)
+            send_final();
+    }
+};
+
+void upstream::fail(const boost::system::error_code& ec)
+{
+    if (!connected_)
+        return;
+    fprintf(PRINT_STREAM, "crapgw::upstream::fail(%s)\n", ec.message().c_str());
+    connected_ = false;
+    std::vector<std::shared_ptr<client>> owners;
+    owners.swap(owners_);
+    for (size_t i = 0; i < owners.size(); ++i)
+        if (owners[i])
+            owners[i]->upstream_lost();
+    owners_.assign(rap_max_conn_id + 1, std::shared_ptr<client>());
+    blocked_.clear();
+    in_flight_ = 0;
+    reset();
+    socket_ = tcp::socket(io_service_);
+    retry();
+}
+
+// lets the owners of connections that have sent their queues read on
+void upstream::unblock()
+{
+    for (size_t i = 0; i < blocked_.size();) {
+        rap_conn_id id = blocked_[i];
+        if (!rap_conn_is_idle(rap_muxer_get_conn(muxer_, id))) {
+            ++i;
+            continue;
+        }
+        blocked_[i] = blocked_.back();
+        blocked_.pop_back();
+        std::shared_ptr<client> owner(owners_[id]);
+        if (owner)
+            owner->unblocked();
+    }
+}
+
+class gateway {
+public:
+    gateway(unsigned short port, const tcp::endpoint& upstream_endpoint, size_t links)
+        : acceptor_(io_service_, tcp::endpoint(tcp::v4(), port))
+        , socket_(io_service_)
+        , timer_(io_service_)
+        , last_head_count_(0)
+    {
+        for (size_t i = 0; i < links; ++i) {
+            upstreams_.push_back(std::make_shared<upstream>(io_service_, upstream_endpoint));
+            upstreams_.back()->start();
+        }
+        do_accept();
+        do_timer();
+    }
+
+    void run() { io_service_.run(); }
+
+private:
+    boost::asio::io_service io_service_;
+    tcp::acceptor acceptor_;
+    tcp::socket socket_;
+    boost::asio::deadline_timer timer_;
+    std::vector<std::shared_ptr<upstream>> upstreams_;
+    rap::stats stats_;
+    uint64_t last_head_count_;
+
+    void do_accept()
+    {
+        acceptor_.async_accept(socket_, [this](boost::system::error_code ec) {
+            if (!ec) {
+                socket_.set_option(tcp::no_delay(true));
+                std::make_shared<client>(io_service_, std::move(socket_), upstreams_, stats_)->start();
+            }
+            do_accept();
+        });
+    }
+
+    void do_timer()
+    {
+        timer_.expires_from_now(boost::posix_time::seconds(1));
+        timer_.async_wait([this](const boost::system::error_code& ec) {
+            if (ec)
+                return;
+            uint64_t n = stats_.head_count;
+            if (n != last_head_count_) {
+                fprintf(PRINT_STREAM, "%llu Rps\n", static_cast<unsigned long long>(n - last_head_count_));
+                last_head_count_ = n;
+            }
+            do_timer();
+        });
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    const char* port = argc > 1 ? argv[1] : "8080";
+    const char* upstream_host = argc > 2 ? argv[2] : "127.0.0.1";
+    const char* upstream_port = argc > 3 ? argv[3] : "10111";
+    int links = argc > 4 ? std::atoi(argv[4]) : 2;
+    try {
+        tcp::endpoint endpoint(boost::asio::ip::address::from_string(upstream_host),
+            static_cast<unsigned short>(std::atoi(upstream_port)));
+        gateway g(static_cast<unsigned short>(std::atoi(port)), endpoint, links > 0 ? static_cast<size_t>(links) : 1);
+        g.run();
+    } catch (std::exception& e) {
+        fprintf(PRINT_STREAM, "Exception: %s\n", e.what());
+    }
+    return 0;
+}
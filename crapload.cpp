@@ -0,0 +1,331 @@
+/**
+ * @brief REST Aggregation Protocol load generator
+ *
+ * Opens RAP links to a server such as crapper and keeps a number of
+ * requests in flight on each, starting the next request on a connection
+ * as soon as its response ends. Every thread runs its own io_service with
+ * its own links, so the load side shares nothing between cores either.
+ * Prints the requests and response body bytes per second.
+ *
+ * Usage: crapload [-t threads] [-l links] [-c conns] [-b bytes] [-d seconds] [host [port]]
+ *   -t threads  threads, each with its own links (default 1)
+ *   -l links    links per thread (default 1)
+ *   -c conns    requests in flight per link (default 64)
+ *   -b bytes    request body size (default 0)
+ *   -d seconds  how long to run (default 10)
+ */
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "rap.hpp"
+#include "rap_conn.hpp"
+#include "rap_muxer.hpp"
+#include "rap_record.hpp"
+#include "rap_writer.hpp"
+
+/* crap.h must be included after rap.hpp */
+#include "crap.h"
+
+#define PRINT_STREAM stderr
+
+using boost::asio::ip::tcp;
+
+namespace {
+
+// what one thread has seen, read by main() once the thread is done
+struct counters {
+    uint64_t requests;
+    uint64_t bytes;
+    bool failed;
+};
+
+/*
+ * link is one RAP link to the server, with a request in flight on each
+ * of its first conns connections.
+ */
+class link {
+public:
+    link(boost::asio::io_service& io_service, const tcp::endpoint& endpoint,
+        int conns, size_t body_size, counters& counters)
+        : socket_(io_service)
+        , endpoint_(endpoint)
+        , conns_(conns)
+        , counters_(counters)
+        , muxer_(nullptr)
+        , stopped_(false)
+        , head_(rap_frame_max_size)
+        , body_(rap_frame_max_size)
+        , body_size_(body_size)
+    {
+        rap_frame* f = reinterpret_cast<rap_frame*>(head_.data());
+        char* start = f->payload();
+        rap::span_writer w(start, start + rap_frame_max_payload_size);
+        char tag = rap::record::tag_http_request;
+        w.write(&tag, 1);
+        w.write_text("GET", 3);
+        w.write_text("http", 4);
+        w.write_length(0);
+        w.write_text("/", 1);
+        w.write_text(nullptr, 0); // query
+        w.write_text(nullptr, 0); // headers
+        w.write_text("localhost", 9);
+        w.write_int64(static_cast<int64_t>(body_size));
+        f->header().set_head();
+        f->header().set_size_value(static_cast<size_t>(w.data() - start));
+        memset(body_.data(), 'x', body_.size());
+    }
+
+    ~link()
+    {
+        if (muxer_)
+            rap_muxer_destroy(muxer_);
+    }
+
+    void start()
+    {
+        socket_.async_connect(endpoint_, [this](boost::system::error_code ec) {
+            if (ec) {
+                fail("connect", ec);
+                return;
+            }
+            socket_.set_option(tcp::no_delay(true));
+            muxer_ = rap_muxer_create(this, s_write_cb, nullptr);
+            rap_muxer_set_writev_cb(muxer_, s_writev_cb);
+            rap_muxer_send_setup(muxer_);
+            rap_muxer_cork(muxer_);
+            for (int id = 0; id < conns_; ++id) {
+                rap_conn* conn = rap_muxer_get_conn(muxer_, id);
+                rap_conn_set_callback(conn, s_conn_cb, this);
+                send_request(conn);
+            }
+            rap_muxer_uncork(muxer_);
+            read_stream();
+        });
+    }
+
+    // stops starting new requests
+    void stop() { stopped_ = true; }
+
+private:
+    enum {
+        max_length = 0x10000
+    };
+
+    tcp::socket socket_;
+    tcp::endpoint endpoint_;
+    int conns_;
+    counters& counters_;
+    rap_muxer* muxer_;
+    bool stopped_;
+    std::vector<char> head_;
+    std::vector<char> body_;
+    size_t body_size_;
+    std::vector<char> buf_towrite_;
+    std::vector<char> buf_writing_;
+    char data_[max_length];
+
+    void send_request(rap_conn* conn)
+    {
+        rap_conn_id id = rap_conn_get_id(conn);
+        rap_frame* f = reinterpret_cast<rap_frame*>(head_.data());
+        f->header().set_id(id);
+        rap_conn_write_frame(conn, f);
+        f = reinterpret_cast<rap_frame*>(body_.data());
+        for (size_t left = body_size_; left > 0;) {
+            size_t n = left;
+            if (n > rap_frame_max_payload_size)
+                n = rap_frame_max_payload_size;
+            f->header() = rap_header(id);
+            f->header().set_body();
+            f->header().set_size_value(n);
+            rap_conn_write_frame(conn, f);
+            left -= n;
+        }
+        rap_header h(id);
+        h.set_final();
+        rap_conn_write_frame(conn, reinterpret_cast<const rap_frame*>(&h));
+    }
+
+    static int s_conn_cb(void* self, rap_conn* conn, const rap_frame* f, int len)
+    {
+        return static_cast<link*>(self)->conn_cb(conn, f, len);
+    }
+
+    // our final went out with the request, so the response's ends the exchange
+    int conn_cb(rap_conn* conn, const rap_frame* f, int)
+    {
+        const rap_header& hdr = f->header();
+        if (hdr.is_final()) {
+            counters_.requests++;
+            if (!stopped_)
+                send_request(conn);
+        } else if (hdr.has_body()) {
+            counters_.bytes += f->payload_size();
+        }
+        return 0;
+    }
+
+    static int s_write_cb(void* self, const char* src_ptr, int src_len)
+    {
+        link* l = static_cast<link*>(self);
+        l->buf_towrite_.insert(l->buf_towrite_.end(), src_ptr, src_ptr + src_len);
+        l->write_some();
+        return 0;
+    }
+
+    static int s_writev_cb(void* self, const rap_iovec* iov, int iovcnt)
+    {
+        link* l = static_cast<link*>(self);
+        for (int i = 0; i < iovcnt; ++i) {
+            const char* src_ptr = static_cast<const char*>(iov[i].iov_base);
+            l->buf_towrite_.insert(l->buf_towrite_.end(), src_ptr, src_ptr + iov[i].iov_len);
+        }
+        l->write_some();
+        return 0;
+    }
+
+    void write_some()
+    {
+        if (!buf_writing_.empty() || buf_towrite_.empty() || counters_.failed)
+            return;
+        buf_writing_.swap(buf_towrite_);
+        boost::asio::async_write(socket_, boost::asio::buffer(buf_writing_),
+            [this](boost::system::error_code ec, std::size_t) {
+                buf_writing_.clear();
+                if (ec) {
+                    fail("write", ec);
+                    return;
+                }
+                write_some();
+            });
+    }
+
+    void read_stream()
+    {
+        socket_.async_read_some(boost::asio::buffer(data_, max_length),
+            [this](boost::system::error_code ec, std::size_t length) {
+                if (ec) {
+                    fail("read", ec);
+                    return;
+                }
+                int rap_ec = rap_muxer_recv(muxer_, data_, static_cast<int>(length));
+                if (rap_ec < 0) {
+                    fprintf(PRINT_STREAM, "crapload::link::read_stream(): rap error %d\n", rap_ec);
+                    counters_.failed = true;
+                    return;
+                }
+                read_stream();
+            });
+    }
+
+    void fail(const char* what, const boost::system::error_code& ec)
+    {
+        if (stopped_ || counters_.failed)
+            return;
+        fprintf(PRINT_STREAM, "crapload::link::%s(%s)\n", what, ec.message().c_str());
+        counters_.failed = true;
+    }
+};
+
+struct options {
+    int threads;
+    int links;
+    int conns;
+    size_t body_size;
+    double seconds;
+};
+
+// runs the links of one thread for the given time, counting what ends in it
+void run_thread(const tcp::endpoint& endpoint, const options& opt, counters& c)
+{
+    boost::asio::io_service io_service;
+    std::vector<std::unique_ptr<link>> links;
+    for (int i = 0; i < opt.links; ++i) {
+        links.emplace_back(new link(io_service, endpoint, opt.conns, opt.body_size, c));
+        links.back()->start();
+    }
+    boost::asio::deadline_timer timer(io_service);
+    timer.expires_from_now(boost::posix_time::microseconds(static_cast<int64_t>(opt.seconds * 1e6)));
+    timer.async_wait([&](const boost::system::error_code&) {
+        for (size_t i = 0; i < links.size(); ++i)
+            links[i]->stop();
+        io_service.stop();
+    });
+    io_service.run();
+}
+
+int usage()
+{
+    fprintf(PRINT_STREAM, "usage: crapload [-t threads] [-l links] [-c conns] [-b bytes] [-d seconds] [host [port]]\n");
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    options opt = { 1, 1, 64, 0, 10.0 };
+    int ch;
+    while ((ch = getopt(argc, argv, "t:l:c:b:d:")) != -1) {
+        switch (ch) {
+        case 't':
+            opt.threads = std::atoi(optarg);
+            break;
+        case 'l':
+            opt.links = std::atoi(optarg);
+            break;
+        case 'c':
+            opt.conns = std::atoi(optarg);
+            break;
+        case 'b':
+            opt.body_size = static_cast<size_t>(std::atol(optarg));
+            break;
+        case 'd':
+            opt.seconds = std::atof(optarg);
+            break;
+        default:
+            return usage();
+        }
+    }
+    if (argc - optind > 2 || opt.threads < 1 || opt.links < 1 || opt.conns < 1
+        || opt.conns > rap_max_conn_id + 1 || opt.seconds <= 0)
+        return usage();
+    const char* host = optind < argc ? argv[optind] : "127.0.0.1";
+    const char* port = optind + 1 < argc ? argv[optind + 1] : "10111";
+
+    try {
+        tcp::endpoint endpoint(boost::asio::ip::address::from_string(host),
+            static_cast<unsigned short>(std::atoi(port)));
+        std::vector<counters> totals(static_cast<size_t>(opt.threads), counters());
+        std::vector<std::thread> threads;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < opt.threads; ++i)
+            threads.emplace_back(run_thread, std::cref(endpoint), std::cref(opt), std::ref(totals[static_cast<size_t>(i)]));
+        for (size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        counters sum = { 0, 0, false };
+        for (size_t i = 0; i < totals.size(); ++i) {
+            sum.requests += totals[i].requests;
+            sum.bytes += totals[i].bytes;
+            sum.failed |= totals[i].failed;
+        }
+        printf("%d threads, %d links, %d conns: %.0f requests/s, %.1f MB/s\n",
+            opt.threads, opt.threads * opt.links, opt.threads * opt.links * opt.conns,
+            static_cast<double>(sum.requests) / secs, static_cast<double>(sum.bytes) / secs / 1e6);
+        return sum.failed ? 1 : 0;
+    } catch (std::exception& e) {
+        fprintf(PRINT_STREAM, "Exception: %s\n", e.what());
+    }
+    return 1;
+}
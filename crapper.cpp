@@ -4,12 +4,16 @@
  * @note Copyright (c)2015-2017 Johan Lindh
  */
 
+#include <algorithm>
+#include <atomic>
 #include <boost/asio.hpp>
-#include <boost/thread.hpp>
+#include <csignal>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 
 #include "rap.hpp"
@@ -18,39 +22,73 @@
 #include "rap_reader.hpp"
 #include "rap_request.hpp"
 #include "rap_response.hpp"
+#include "rap_sendqueue.hpp"
 #include "rap_stats.hpp"
+#include "rap_uring.hpp"
 
 /* crap.h must be included after rap.hpp */
 #include "crap.h"
 
+#if RAP_URING
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#endif
+
 #define PRINT_STREAM stderr
-#define PRINT_NETDATA 1
-
-#if PRINT_NETDATA
-static void print_netdata(char rw, const char* src_ptr, const char* src_end) {
-    while (src_ptr < src_end) {
-        const char* p = src_ptr;
-        int n = 0;
-        fprintf(PRINT_STREAM, "%c: ", rw);
-        while (p < src_end && n++ < 16)
-            fprintf(PRINT_STREAM, "%02x ", (*p++) & 0xFF);
-        while (n++ < 16)
-            fprintf(PRINT_STREAM, "   ");
-        fputc(' ', PRINT_STREAM);
-        p = src_ptr;
-        n = 0;
-        while (p < src_end && n++ < 16) {
-            int ch = (*p++) & 0xFF;
-            if (!isgraph(ch)) ch = '.';
-            fputc(ch, PRINT_STREAM);
-        }
-        fputc('\n', PRINT_STREAM);
-        src_ptr += 16;
-    }
-    fflush(PRINT_STREAM);
+
+/*
+ * Wire tracing. With CRAPPER_TRACE naming a capture file, each SIGUSR1
+ * starts tracing the next session to read data, or stops the one being
+ * traced. Decode the capture with craptrace.
+ */
+enum {
+    trace_off,
+    trace_armed,
+    trace_on,
+    trace_capacity = 0x4000000
+};
+static rap_tracer* trace_file = nullptr;
+static std::atomic<int> trace_state(trace_off);
+static std::atomic<unsigned> trace_links(0);
+
+static void toggle_trace(int)
+{
+    int state = trace_off;
+    if (!trace_state.compare_exchange_strong(state, trace_armed))
+        trace_state.store(trace_off);
 }
-#endif
 
+// starts or stops tracing a session's muxer as asked, returning whether
+// it is traced; costs a relaxed load while tracing is off
+static bool update_trace(rap_muxer* muxer, bool traced)
+{
+    int state = trace_state.load(std::memory_order_relaxed);
+    if (traced) {
+        if (state == trace_on)
+            return true;
+        rap_muxer_set_tracer(muxer, nullptr, 0);
+        fprintf(PRINT_STREAM, "crapper: trace stopped\n");
+        return false;
+    }
+    if (state != trace_armed || !trace_state.compare_exchange_strong(state, trace_on))
+        return false;
+    unsigned link = ++trace_links;
+    rap_muxer_set_tracer(muxer, trace_file, link);
+    fprintf(PRINT_STREAM, "crapper: tracing link %u\n", link);
+    return true;
+}
+
+// the trace ends with the session being traced
+static void end_trace(bool traced)
+{
+    int state = trace_on;
+    if (traced && trace_state.compare_exchange_strong(state, trace_off))
+        fprintf(PRINT_STREAM, "crapper: trace stopped\n");
+}
 
 using boost::asio::ip::tcp;
 
@@ -62,6 +100,7 @@ public:
         , contentlength_(-1)
         , contentread_(0)
         , id_(rap_muxer_conn_id)
+        , final_sent_(false)
     {
     }
 
@@ -93,7 +132,7 @@ public:
         return static_cast<class conn*>(conn_cb_param)->conn_cb(conn, f, len);
     }
 
-    int conn_cb(rap_conn* /*conn*/, const rap_frame* f, int len)
+    int conn_cb(rap_conn* conn, const rap_frame* f, int len)
     {
         // TODO: thread safety?
         assert(f != nullptr);
@@ -101,17 +140,20 @@ public:
         assert(len == rap_frame_header_size + static_cast<int>(f->header().payload_size()));
 
         const rap_header& hdr = f->header();
-        rap::reader r(f);
+        rap::reader r(f, &conn->strings(), &conn->routes());
         if (hdr.has_head()) {
             if (stats_)
                 stats_->head_count++;
             process_head(r);
-        }
-        if (hdr.is_final() || (contentlength_ >= 0 && contentread_ >= contentlength_))
-            write_frame(finalframe_);
-        else if (hdr.has_body())
+        } else if (hdr.has_body() && !hdr.is_final())
             process_body(r);
         pubsync();
+        if (hdr.is_final() || (contentlength_ >= 0 && contentread_ >= contentlength_)) {
+            // the peer may send its final after we're done, don't answer it twice
+            if (!final_sent_)
+                write_frame(finalframe_);
+            final_sent_ = true;
+        }
         return 0;
     }
 
@@ -125,7 +167,11 @@ public:
         header().set_head();
         contentread_ = 0;
         contentlength_ = req.content_length();
-        rap::writer(*this) << rap::response(200, contentlength_ + static_cast<int64_t>(req_echo_.size()));
+        final_sent_ = false;
+        int64_t echo_length = static_cast<int64_t>(req_echo_.size());
+        if (contentlength_ > 0)
+            echo_length += contentlength_;
+        rap::writer(*this) << rap::response(200, echo_length);
         header().set_body();
         sputn(req_echo_.data(), static_cast<std::streamsize>(req_echo_.size()));
         return r.error();
@@ -135,7 +181,6 @@ public:
     {
         assert(r.size() > 0);
         header().set_body();
-        sputc('\n');
         sputn(r.data(), static_cast<std::streamsize>(r.size()));
         contentread_ += r.size();
         r.consume();
@@ -156,11 +201,19 @@ protected:
     conn::int_type overflow(int_type ch)
     {
         if (buf_.size() < rap_frame_max_size) {
+            // grow the frame, keeping what has been written so far
+            int used = static_cast<int>(pptr() - pbase());
             size_t new_size = buf_.size() * 2;
             if (new_size > rap_frame_max_size)
                 new_size = rap_frame_max_size;
             buf_.resize(new_size);
             setp(buf_.data() + rap_frame_header_size, buf_.data() + buf_.size());
+            pbump(used);
+            if (ch != traits_type::eof()) {
+                *pptr() = static_cast<char>(ch);
+                pbump(1);
+            }
+            return traits_type::not_eof(ch);
         }
 
         bool was_head = header().has_head();
@@ -212,6 +265,7 @@ private:
     int64_t contentread_;
     rap_conn_id id_;
     rap_header finalframe_;
+    bool final_sent_;
 
     void start_write()
     {
@@ -227,16 +281,27 @@ private:
 
 class session : public std::enable_shared_from_this<session> {
 public:
-    session(tcp::socket socket, rap::stats& stats)
-        : socket_(std::move(socket))
-        , conns_(rap_max_conn_id + 1)
+    session(boost::asio::io_service& io_service, tcp::socket socket, rap::stats& stats)
+        : io_service_(io_service)
+        , socket_(std::move(socket))
+        , data_(new char[min_read_size])
+        , data_size_(min_read_size)
+        , small_reads_(0)
+        , flushing_(false)
+        , failed_(false)
+        , traced_(false)
         , muxer_(nullptr)
         , stats_(stats)
     {
+        writing_.reserve(max_gather);
+        write_bufs_.reserve(max_gather);
     }
 
     ~session()
     {
+        end_trace(traced_);
+        for (size_t i = 0; i < writing_.size(); ++i)
+            rap::sendqueue::recycle(writing_[i]);
         if (muxer_) {
             rap_muxer_destroy(muxer_);
             muxer_ = nullptr;
@@ -247,7 +312,11 @@ public:
     {
         if (!muxer_) {
             muxer_ = rap_muxer_create(this, s_write_cb, s_conn_init_cb);
+            rap_muxer_set_writev_cb(muxer_, s_writev_cb);
         }
+        // lets write_direct() and read_stream() take only what is there
+        boost::system::error_code ec;
+        socket_.non_blocking(true, ec);
         read_stream();
     }
 
@@ -257,111 +326,805 @@ private:
         return static_cast<session*>(self)->write_cb(src_ptr, src_len);
     }
 
+    static int s_writev_cb(void* self, const rap_iovec* iov, int iovcnt)
+    {
+        return static_cast<session*>(self)->writev_cb(iov, iovcnt);
+    }
+
     static void s_conn_init_cb(void* self, rap_conn_id id, rap_conn* conn)
     {
         static_cast<session*>(self)->conn_init(id, conn);
     }
 
-    // may be called from a foreign thread via the callback
     int write_cb(const char* src_ptr, int src_len)
     {
-        std::lock_guard<std::mutex> g(write_mtx_);
-        buf_towrite_.insert(buf_towrite_.end(), src_ptr, src_ptr + src_len);
-        write_some();
-        return 0;
+        rap_iovec iov;
+        iov.iov_base = src_ptr;
+        iov.iov_len = static_cast<size_t>(src_len);
+        return writev_cb(&iov, 1);
     }
 
-    void conn_init(rap_conn_id id, rap_conn* conn)
+    /*
+     * May be called from a foreign thread via the callback. On our own
+     * thread with nothing queued the buffers are written straight to the
+     * socket, and only what it doesn't take right away is copied. Otherwise
+     * the bytes go on the queue, and whoever sets flushing_ writes it out.
+     */
+    int writev_cb(const rap_iovec* iov, int iovcnt)
     {
-        conns_[id].init(conn, &stats_);
+        if (failed_.load(std::memory_order_relaxed))
+            return -1;
+        size_t sent = 0;
+        bool flush_now = false;
+        if (io_service_.get_executor().running_in_this_thread()
+            && !flushing_.exchange(true, std::memory_order_acq_rel)) {
+            if (queue_.empty())
+                sent = write_direct(iov, iovcnt);
+            flush_now = true;
+        }
+        if (!failed_.load(std::memory_order_relaxed) && queue_.push(iov, iovcnt, sent)) {
+            failed_.store(true, std::memory_order_relaxed);
+            fprintf(PRINT_STREAM, "crapper::muxer::writev_cb(): out of buffers\n");
+        }
+        if (flush_now)
+            flush();
+        else if (!flushing_.exchange(true, std::memory_order_acq_rel)) {
+            auto self(shared_from_this());
+            io_service_.dispatch([this, self]() { flush(); });
+        }
+        return failed_.load(std::memory_order_relaxed) ? -1 : 0;
     }
 
-    // writes any buffered data to the stream using muxer_t::write_stream()
-    // may be called from a foreign thread via the callback
-    void write_some()
+    // writes as much as the socket takes without blocking
+    size_t write_direct(const rap_iovec* iov, int iovcnt)
     {
-        if (!buf_writing_.empty() || buf_towrite_.empty())
-            return;
-        buf_writing_.swap(buf_towrite_);
-        write_stream(buf_writing_.data(), buf_writing_.size());
-        return;
+        write_bufs_.clear();
+        for (int i = 0; i < iovcnt && write_bufs_.size() < max_gather; ++i)
+            write_bufs_.push_back(boost::asio::buffer(iov[i].iov_base, iov[i].iov_len));
+        boost::system::error_code ec;
+        size_t length = socket_.write_some(write_bufs_, ec);
+        write_bufs_.clear();
+        if (ec) {
+            if (ec != boost::asio::error::would_block)
+                write_failed(ec, 0);
+            return 0;
+        }
+        stats_.add_bytes_written(length);
+        return length;
     }
 
-    void write_stream(const char* src_ptr, size_t src_len)
+    // writes out the queue, called by whoever set flushing_
+    void flush()
     {
+        assert(flushing_.load(std::memory_order_relaxed));
+        assert(writing_.empty());
+        while (writing_.size() < max_gather) {
+            rap::sendqueue::buffer* b = queue_.pop();
+            if (b == nullptr)
+                break;
+            writing_.push_back(b);
+            write_bufs_.push_back(boost::asio::buffer(b->data(), b->size));
+        }
+        if (writing_.empty() || failed_.load(std::memory_order_relaxed)) {
+            recycle_writing();
+            flushing_.store(false, std::memory_order_release);
+            // a producer that saw flushing_ set has already queued its bytes
+            if (!queue_.empty() && !failed_.load(std::memory_order_relaxed)
+                && !flushing_.exchange(true, std::memory_order_acq_rel)) {
+                auto self(shared_from_this());
+                io_service_.post([this, self]() { flush(); });
+            }
+            return;
+        }
         auto self(shared_from_this());
-
-#if PRINT_NETDATA
-        print_netdata('W', src_ptr, src_ptr + src_len);
-#endif
-
-        boost::asio::async_write(
-            socket_, boost::asio::buffer(src_ptr, src_len),
+        boost::asio::async_write(socket_, write_bufs_,
             [this, self](boost::system::error_code ec, std::size_t length) {
-                std::lock_guard<std::mutex> g(write_mtx_);
+                recycle_writing();
                 if (ec) {
-                    fprintf(PRINT_STREAM, "crapper::muxer::write_stream(%s, %lu)\n",
-                        ec.message().c_str(), static_cast<unsigned long>(length));
-                    fflush(PRINT_STREAM);
+                    write_failed(ec, length);
+                    flushing_.store(false, std::memory_order_release);
                     return;
-                } else {
-                    assert(length == buf_writing_.size());
-                    stats_.add_bytes_written(length);
                 }
-                buf_writing_.clear();
-                write_some();
+                stats_.add_bytes_written(length);
+                flush();
             });
-        return;
+    }
+
+    void recycle_writing()
+    {
+        for (size_t i = 0; i < writing_.size(); ++i)
+            rap::sendqueue::recycle(writing_[i]);
+        writing_.clear();
+        write_bufs_.clear();
+    }
+
+    void write_failed(const boost::system::error_code& ec, std::size_t length)
+    {
+        failed_.store(true, std::memory_order_relaxed);
+        fprintf(PRINT_STREAM, "crapper::muxer::write_stream(%s, %lu)\n",
+            ec.message().c_str(), static_cast<unsigned long>(length));
+        fflush(PRINT_STREAM);
+    }
+
+    void conn_init(rap_conn_id id, rap_conn* conn)
+    {
+        std::unique_ptr<class conn>& c = conns_[id];
+        if (!c)
+            c.reset(new class conn());
+        c->init(conn, &stats_);
     }
 
     void read_stream()
     {
         auto self(shared_from_this());
         socket_.async_read_some(
-            boost::asio::buffer(data_, max_length),
+            boost::asio::buffer(data_.get(), data_size_),
             [this, self](boost::system::error_code ec, std::size_t length) {
-                if (ec) {
-                    if (ec != boost::asio::error::eof) {
-                        fprintf(PRINT_STREAM, "crapper::muxer::read_stream(%s, %lu) [%d]\n",
-                            ec.message().c_str(), static_cast<unsigned long>(length),
-                            ec.value());
-                        fflush(PRINT_STREAM);
+                // a read that filled the buffer likely left more behind, so
+                // keep reading while it does, but only so much per wakeup
+                std::size_t drained = 0;
+                for (int reads = 1;; ++reads) {
+                    if (ec) {
+                        if (ec == boost::asio::error::would_block)
+                            break;
+                        if (ec != boost::asio::error::eof) {
+                            fprintf(PRINT_STREAM, "crapper::muxer::read_stream(%s, %lu) [%d]\n",
+                                ec.message().c_str(), static_cast<unsigned long>(length),
+                                ec.value());
+                            fflush(PRINT_STREAM);
+                        }
+                        return;
                     }
-                    return;
-                }
-                stats_.add_bytes_read(length);
-#if PRINT_NETDATA
-                print_netdata('R', data_, data_ + length);
-#endif
-                int rap_ec = rap_muxer_recv(muxer_, data_, static_cast<int>(length));
-                if (rap_ec < 0) {
-                    fprintf(PRINT_STREAM, "crapper::muxer::read_stream(): rap error %d\n",
-                        rap_ec);
-                    fflush(PRINT_STREAM);
-                } else {
-                    assert(rap_ec == static_cast<int>(length));
+                    bool full = length == data_size_;
+                    process_read(length);
+                    drained += length;
+                    if (!full || reads >= max_drain_reads || drained >= max_drain_bytes)
+                        break;
+                    length = socket_.read_some(boost::asio::buffer(data_.get(), data_size_), ec);
                 }
-
                 read_stream();
             });
     }
 
+    void process_read(std::size_t length)
+    {
+        stats_.add_bytes_read(length);
+        traced_ = update_trace(muxer_, traced_);
+        int rap_ec = rap_muxer_recv(muxer_, data_.get(), static_cast<int>(length));
+        if (rap_ec < 0) {
+            fprintf(PRINT_STREAM, "crapper::muxer::read_stream(): rap error %d\n",
+                rap_ec);
+            fflush(PRINT_STREAM);
+        } else {
+            assert(rap_ec == static_cast<int>(length));
+        }
+        fit_buffer(length);
+    }
+
+    // doubles the receive buffer when a read fills it, and halves it
+    // after shrink_after reads in a row that used less than a quarter
+    void fit_buffer(std::size_t length)
+    {
+        std::size_t size = data_size_;
+        if (length == size && size < max_read_size)
+            size *= 2;
+        else if (length >= size / 4 || size <= min_read_size)
+            small_reads_ = 0;
+        else if (++small_reads_ >= shrink_after)
+            size /= 2;
+        if (size != data_size_) {
+            data_.reset(new char[size]);
+            data_size_ = size;
+            small_reads_ = 0;
+        }
+    }
+
     enum {
-        max_length = 4096
+        min_read_size = 0x1000,
+        max_read_size = 0x40000,
+        shrink_after = 8,
+        max_drain_reads = 16, /**< reads per wakeup */
+        max_drain_bytes = 0x100000, /**< bytes per wakeup */
+        max_gather = 64 /**< buffers per gather write, well below IOV_MAX */
     };
+    boost::asio::io_service& io_service_;
     tcp::socket socket_;
-    char data_[max_length];
-    std::mutex write_mtx_; // guards the buffers below
-    std::vector<char> buf_towrite_;
-    std::vector<char> buf_writing_;
-    std::vector<conn> conns_;
+    std::unique_ptr<char[]> data_;
+    std::size_t data_size_;
+    unsigned small_reads_; // reads in a row that used little of data_
+    rap::sendqueue queue_;
+    std::atomic<bool> flushing_; // set while one thread owns writing to the socket
+    std::atomic<bool> failed_;
+    bool traced_;
+    std::vector<rap::sendqueue::buffer*> writing_;
+    std::vector<boost::asio::const_buffer> write_bufs_;
+    std::unordered_map<rap_conn_id, std::unique_ptr<conn>> conns_;
     rap_muxer* muxer_;
     rap::stats& stats_;
 };
 
+#ifdef SO_REUSEPORT
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+/*
+ * shard is one event loop with its own acceptor. Every session it accepts
+ * stays on its thread, so nothing on the session path is shared with
+ * other shards.
+ */
+class shard {
+public:
+    virtual ~shard() {}
+    virtual void run() = 0;
+    virtual void stop() = 0;
+    rap::stats& stats() { return stats_; }
+
+protected:
+    rap::stats stats_;
+};
+
+/*
+ * asio_shard is a shard running a Boost.Asio io_service.
+ */
+class asio_shard : public shard {
+public:
+    asio_shard(unsigned short port, bool share_port)
+        : acceptor_(io_service_)
+        , socket_(io_service_)
+    {
+        tcp::endpoint endpoint(tcp::v4(), port);
+        acceptor_.open(endpoint.protocol());
+        acceptor_.set_option(tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+        if (share_port)
+            acceptor_.set_option(reuse_port(true));
+#else
+        assert(!share_port);
+#endif
+        acceptor_.bind(endpoint);
+        acceptor_.listen();
+        do_accept();
+    }
+
+    void run() override { io_service_.run(); }
+    void stop() override { io_service_.stop(); }
+
+private:
+    void do_accept()
+    {
+        acceptor_.async_accept(socket_, [this](boost::system::error_code ec) {
+            if (!ec) {
+                boost::asio::ip::tcp::no_delay no_delay_option;
+                boost::asio::socket_base::receive_buffer_size
+                    receive_buffer_size_option;
+                boost::asio::socket_base::send_buffer_size send_buffer_size_option;
+                socket_.get_option(no_delay_option);
+                socket_.get_option(receive_buffer_size_option);
+                socket_.get_option(send_buffer_size_option);
+                fprintf(PRINT_STREAM,
+                    "connection established (no_delay %d, read_stream %d, send %d)\n",
+                    no_delay_option.value(),
+                    receive_buffer_size_option.value(),
+                    send_buffer_size_option.value());
+                std::make_shared<session>(io_service_, std::move(socket_), stats_)->start();
+            }
+            do_accept();
+        });
+    }
+
+    boost::asio::io_service io_service_;
+    tcp::acceptor acceptor_;
+    tcp::socket socket_;
+};
+
+#if RAP_URING
+/*
+ * uring_shard is a shard doing its socket I/O through io_uring.
+ *
+ * Connections come from a multishot accept, and each one has a multishot
+ * receive taking its buffers from a ring shared by the shard. Output is
+ * copied into buffers registered with the ring and sent as one chain of
+ * linked sends per session, which goes to the kernel in the same system
+ * call that waits for the next completions. Full buffers are sent with
+ * zero-copy IORING_OP_SEND_ZC straight from the registered memory.
+ *
+ * The sends use MSG_WAITALL, so that a short send cuts the chain instead
+ * of letting the next one through out of order.
+ *
+ * The muxer callbacks of a uring_shard session must only be called on
+ * the shard's thread.
+ */
+class uring_shard : public shard {
+public:
+    uring_shard()
+        : listen_fd_(-1)
+        , event_fd_(-1)
+        , send_arena_(static_cast<char*>(MAP_FAILED))
+        , zerocopy_(false)
+        , stopping_(false)
+    {
+    }
+
+    ~uring_shard()
+    {
+        // closing the ring first cancels whatever is still in flight
+        ring_.close();
+        while (!sessions_.empty())
+            destroy(sessions_.back());
+        for (size_t i = 0; i < spare_.size(); ++i)
+            delete spare_[i];
+        if (send_arena_ != MAP_FAILED)
+            munmap(send_arena_, send_slots * send_slot_size);
+        if (listen_fd_ >= 0)
+            ::close(listen_fd_);
+        if (event_fd_ >= 0)
+            ::close(event_fd_);
+    }
+
+    /*
+     * Sets up the ring and a listening socket on @a port, returning a
+     * negative errno value if this kernel can't run the shard.
+     */
+    int init(unsigned short port, bool share_port)
+    {
+        int err = ring_.init(ring_entries);
+        if (err == 0)
+            err = recv_bufs_.init(ring_, recv_buffers, recv_buffer_size, 0);
+        if (err)
+            return err;
+
+        // without registered buffers, output is sent from pooled frames
+        void* arena = mmap(nullptr, send_slots * send_slot_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (arena != MAP_FAILED) {
+            struct iovec iov;
+            iov.iov_base = arena;
+            iov.iov_len = send_slots * send_slot_size;
+            if (ring_.register_buffers(&iov, 1) == 0) {
+                send_arena_ = static_cast<char*>(arena);
+                zerocopy_ = true;
+                for (int slot = send_slots - 1; slot >= 0; --slot)
+                    free_slots_.push_back(slot);
+            } else
+                munmap(arena, send_slots * send_slot_size);
+        }
+
+        listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd_ < 0)
+            return -errno;
+        int one = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (share_port && setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+            return -errno;
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0
+            || listen(listen_fd_, SOMAXCONN) < 0)
+            return -errno;
+        event_fd_ = eventfd(0, EFD_CLOEXEC);
+        if (event_fd_ < 0)
+            return -errno;
+        // writes to a closed socket must fail rather than raise SIGPIPE
+        signal(SIGPIPE, SIG_IGN);
+        if (!arm_accept() || !arm_stop())
+            return -EBUSY;
+        return 0;
+    }
+
+    void run() override
+    {
+        while (!stopping_) {
+            flush_dirty();
+            int rv = ring_.submit(1);
+            if (rv < 0 && rv != -EINTR && rv != -EAGAIN && rv != -EBUSY) {
+                fprintf(PRINT_STREAM, "crapper::uring_shard::run(): %s\n", strerror(-rv));
+                break;
+            }
+            ring_.for_each_cqe([this](const io_uring_cqe& cqe) { complete(cqe); });
+        }
+    }
+
+    void stop() override
+    {
+        uint64_t one = 1;
+        ssize_t n = write(event_fd_, &one, sizeof(one));
+        (void)n;
+    }
+
+private:
+    enum {
+        ring_entries = 4096,
+        recv_buffers = 256, /**< shared by all sessions of the shard */
+        recv_buffer_size = 0x4000,
+        send_slots = 256,
+        send_slot_size = 0x4000,
+        max_chain = 64, /**< linked sends in flight per session */
+        zerocopy_min = 0x2000, /**< smaller sends are cheaper to copy */
+    };
+
+    // what a completion is for, kept in the low bits of its user_data
+    enum op {
+        op_accept,
+        op_recv,
+        op_write,
+        op_stop,
+        op_mask = 3
+    };
+
+    struct session;
+
+    struct outbuf {
+        outbuf* next;
+        session* owner;
+        char* data;
+        rap_frame* frame; // when not in the send arena
+        int slot; // in the send arena, or -1
+        uint32_t size;
+        uint32_t sent;
+        bool submitted;
+    };
+
+    struct session {
+        uring_shard* shard;
+        int fd;
+        rap_muxer* muxer;
+        std::unordered_map<rap_conn_id, std::unique_ptr<conn>> conns;
+        outbuf* out_head;
+        outbuf* out_tail;
+        unsigned inflight; // sends not completed yet
+        size_t index; // in sessions_
+        bool recv_armed;
+        bool closing;
+        bool dirty;
+        bool traced;
+    };
+
+    rap::uring ring_;
+    rap::uring::bufring recv_bufs_;
+    int listen_fd_;
+    int event_fd_;
+    char* send_arena_;
+    bool zerocopy_; // send_arena_ is registered and SEND_ZC works
+    std::vector<int> free_slots_;
+    std::vector<outbuf*> spare_;
+    std::vector<session*> sessions_;
+    std::vector<session*> dirty_; // sessions to write out or destroy
+    bool stopping_;
+
+    static uint64_t user_data(const void* p, op o)
+    {
+        return reinterpret_cast<uintptr_t>(p) | o;
+    }
+
+    static int s_write_cb(void* self, const char* src_ptr, int src_len)
+    {
+        rap_iovec iov;
+        iov.iov_base = src_ptr;
+        iov.iov_len = static_cast<size_t>(src_len);
+        return s_writev_cb(self, &iov, 1);
+    }
+
+    static int s_writev_cb(void* self, const rap_iovec* iov, int iovcnt)
+    {
+        session* s = static_cast<session*>(self);
+        return s->shard->append(s, iov, iovcnt);
+    }
+
+    static void s_conn_init_cb(void* self, rap_conn_id id, rap_conn* conn)
+    {
+        session* s = static_cast<session*>(self);
+        std::unique_ptr<class conn>& c = s->conns[id];
+        if (!c)
+            c.reset(new class conn());
+        c->init(conn, &s->shard->stats_);
+    }
+
+    bool arm_accept()
+    {
+        io_uring_sqe* sqe = ring_.get_sqe();
+        if (sqe == nullptr)
+            return false;
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listen_fd_;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = user_data(nullptr, op_accept);
+        return true;
+    }
+
+    bool arm_stop()
+    {
+        io_uring_sqe* sqe = ring_.get_sqe();
+        if (sqe == nullptr)
+            return false;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = event_fd_;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = user_data(nullptr, op_stop);
+        return true;
+    }
+
+    bool arm_recv(session* s)
+    {
+        io_uring_sqe* sqe = ring_.get_sqe();
+        if (sqe == nullptr)
+            return false;
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = s->fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = recv_bufs_.bgid();
+        sqe->user_data = user_data(s, op_recv);
+        s->recv_armed = true;
+        return true;
+    }
+
+    void complete(const io_uring_cqe& cqe)
+    {
+        void* p = reinterpret_cast<void*>(static_cast<uintptr_t>(cqe.user_data & ~uint64_t(op_mask)));
+        switch (cqe.user_data & op_mask) {
+        case op_accept:
+            accepted(cqe);
+            break;
+        case op_recv:
+            received(static_cast<session*>(p), cqe);
+            break;
+        case op_write:
+            written(static_cast<outbuf*>(p), cqe);
+            break;
+        case op_stop:
+            stopping_ = true;
+            break;
+        }
+    }
+
+    void accepted(const io_uring_cqe& cqe)
+    {
+        if (cqe.res >= 0) {
+            fprintf(PRINT_STREAM, "connection established (io_uring)\n");
+            session* s = new session();
+            s->shard = this;
+            s->fd = cqe.res;
+            // like the asio sessions, don't hold back small frames
+            int one = 1;
+            setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            s->muxer = rap_muxer_create(s, s_write_cb, s_conn_init_cb);
+            rap_muxer_set_writev_cb(s->muxer, s_writev_cb);
+            s->out_head = s->out_tail = nullptr;
+            s->inflight = 0;
+            s->index = sessions_.size();
+            s->recv_armed = s->closing = s->dirty = s->traced = false;
+            sessions_.push_back(s);
+            if (!arm_recv(s))
+                close(s);
+        } else if (!stopping_) {
+            fprintf(PRINT_STREAM, "crapper::uring_shard::accept(): %s\n", strerror(-cqe.res));
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE) && !stopping_)
+            arm_accept();
+    }
+
+    void received(session* s, const io_uring_cqe& cqe)
+    {
+        if (cqe.res > 0) {
+            unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            const char* src_ptr = recv_bufs_.data(bid);
+            stats_.add_bytes_read(static_cast<uint64_t>(cqe.res));
+            if (!s->closing) {
+                s->traced = update_trace(s->muxer, s->traced);
+                int rap_ec = rap_muxer_recv(s->muxer, src_ptr, cqe.res);
+                if (rap_ec < 0) {
+                    fprintf(PRINT_STREAM, "crapper::uring_shard::recv(): rap error %d\n", rap_ec);
+                    fflush(PRINT_STREAM);
+                }
+            }
+            recv_bufs_.recycle(bid);
+        } else if (cqe.res != -ENOBUFS) {
+            // end of stream or an error; out of buffers just re-arms
+            if (cqe.res < 0 && cqe.res != -ECONNRESET)
+                fprintf(PRINT_STREAM, "crapper::uring_shard::recv(): %s\n", strerror(-cqe.res));
+            close(s);
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            s->recv_armed = false;
+            if (s->closing)
+                mark_dirty(s); // flush_dirty() may have passed it by while armed
+            else if (!arm_recv(s))
+                close(s);
+        }
+    }
+
+    void written(outbuf* ob, const io_uring_cqe& cqe)
+    {
+        session* s = ob->owner;
+        if (cqe.flags & IORING_CQE_F_NOTIF) {
+            // the kernel is done with a zero-copy buffer
+        } else if (cqe.res > 0) {
+            ob->sent += static_cast<uint32_t>(cqe.res);
+            stats_.add_bytes_written(static_cast<uint64_t>(cqe.res));
+        } else if (zerocopy_ && (cqe.res == -EOPNOTSUPP || cqe.res == -EINVAL)) {
+            // not a TCP socket, or an older kernel; resent without
+            zerocopy_ = false;
+        } else if (cqe.res != -ECANCELED) {
+            // a short send cancels the rest of its chain, which is resent
+            close(s);
+        }
+        if (cqe.flags & IORING_CQE_F_MORE)
+            return; // a zero-copy notification follows
+        if (--s->inflight == 0)
+            mark_dirty(s);
+    }
+
+    // copies output to the session's buffers, to be sent by flush_dirty()
+    int append(session* s, const rap_iovec* iov, int iovcnt)
+    {
+        if (s->closing)
+            return -1;
+        for (int i = 0; i < iovcnt; ++i) {
+            const char* src_ptr = static_cast<const char*>(iov[i].iov_base);
+            size_t src_len = iov[i].iov_len;
+            while (src_len > 0) {
+                outbuf* ob = s->out_tail;
+                if (ob == nullptr || ob->submitted || ob->size == send_slot_size) {
+                    if ((ob = new_outbuf(s)) == nullptr)
+                        return -1;
+                }
+                size_t n = send_slot_size - ob->size;
+                if (n > src_len)
+                    n = src_len;
+                memcpy(ob->data + ob->size, src_ptr, n);
+                ob->size += static_cast<uint32_t>(n);
+                src_ptr += n;
+                src_len -= n;
+            }
+        }
+        mark_dirty(s);
+        return 0;
+    }
+
+    outbuf* new_outbuf(session* s)
+    {
+        outbuf* ob;
+        if (!spare_.empty()) {
+            ob = spare_.back();
+            spare_.pop_back();
+        } else
+            ob = new outbuf();
+        ob->frame = nullptr;
+        ob->slot = -1;
+        if (!free_slots_.empty()) {
+            ob->slot = free_slots_.back();
+            free_slots_.pop_back();
+            ob->data = send_arena_ + static_cast<size_t>(ob->slot) * send_slot_size;
+        } else if ((ob->frame = rap::framepool::create(send_slot_size)) != nullptr) {
+            ob->data = ob->frame->payload();
+        } else {
+            spare_.push_back(ob);
+            return nullptr;
+        }
+        ob->next = nullptr;
+        ob->owner = s;
+        ob->size = ob->sent = 0;
+        ob->submitted = false;
+        if (s->out_tail)
+            s->out_tail->next = ob;
+        else
+            s->out_head = ob;
+        s->out_tail = ob;
+        return ob;
+    }
+
+    void free_outbuf(outbuf* ob)
+    {
+        if (ob->slot >= 0)
+            free_slots_.push_back(ob->slot);
+        else
+            rap::framepool::destroy(ob->frame);
+        spare_.push_back(ob);
+    }
+
+    void mark_dirty(session* s)
+    {
+        if (!s->dirty) {
+            s->dirty = true;
+            dirty_.push_back(s);
+        }
+    }
+
+    void close(session* s)
+    {
+        if (s->closing)
+            return;
+        s->closing = true;
+        // ends the multishot receive and fails the sends in flight
+        shutdown(s->fd, SHUT_RDWR);
+        mark_dirty(s);
+    }
+
+    // sends queued output and destroys sessions that are done
+    void flush_dirty()
+    {
+        for (size_t i = 0; i < dirty_.size(); ++i) {
+            session* s = dirty_[i];
+            s->dirty = false;
+            if (s->inflight > 0)
+                continue;
+            if (s->closing) {
+                if (!s->recv_armed)
+                    destroy(s);
+            } else
+                submit_writes(s);
+        }
+        dirty_.clear();
+    }
+
+    // sends the output of a session with no sends in flight as one chain
+    void submit_writes(session* s)
+    {
+        while (outbuf* ob = s->out_head) {
+            if (ob->sent < ob->size)
+                break;
+            s->out_head = ob->next;
+            if (s->out_head == nullptr)
+                s->out_tail = nullptr;
+            free_outbuf(ob);
+        }
+        unsigned room = ring_.sq_space();
+        if (room > max_chain)
+            room = max_chain;
+        io_uring_sqe* prev = nullptr;
+        for (outbuf* ob = s->out_head; ob != nullptr && s->inflight < room; ob = ob->next) {
+            io_uring_sqe* sqe = ring_.get_sqe();
+            assert(sqe != nullptr);
+            if (prev)
+                prev->flags |= IOSQE_IO_LINK;
+            sqe->fd = s->fd;
+            sqe->addr = reinterpret_cast<uintptr_t>(ob->data + ob->sent);
+            sqe->len = ob->size - ob->sent;
+            sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+            if (ob->slot >= 0 && zerocopy_ && sqe->len >= zerocopy_min) {
+                sqe->opcode = IORING_OP_SEND_ZC;
+                sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+                sqe->buf_index = 0;
+            } else
+                sqe->opcode = IORING_OP_SEND;
+            sqe->user_data = user_data(ob, op_write);
+            ob->submitted = true;
+            ++s->inflight;
+            prev = sqe;
+        }
+        // anything left over goes once this chain completes
+    }
+
+    void destroy(session* s)
+    {
+        end_trace(s->traced);
+        ::close(s->fd);
+        rap_muxer_destroy(s->muxer);
+        s->conns.clear();
+        while (outbuf* ob = s->out_head) {
+            s->out_head = ob->next;
+            free_outbuf(ob);
+        }
+        sessions_[s->index] = sessions_.back();
+        sessions_[s->index]->index = s->index;
+        sessions_.pop_back();
+        delete s;
+    }
+};
+#endif // RAP_URING
+
 class server {
 public:
-    server(unsigned short port)
+    /*
+     * Creates @a num_shards event loops listening on @a port, or one per
+     * core if zero. Without SO_REUSEPORT there is only ever one. If
+     * @a use_uring is set, the shards use io_uring where it works.
+     */
+    server(unsigned short port, size_t num_shards, bool use_uring)
         : last_head_count_(0)
         , last_read_iops_(0)
         , last_read_bytes_(0)
@@ -371,31 +1134,31 @@ public:
         , last_stat_mbps_out_(0)
         , last_stat_rps_(0)
         , timer_(io_service_)
-        , acceptor_(io_service_, tcp::endpoint(tcp::v4(), port))
-        , socket_(io_service_)
-        , thread_pool_size_(1)
     {
+        if (num_shards == 0)
+            num_shards = std::max(1u, std::thread::hardware_concurrency());
+#ifndef SO_REUSEPORT
+        num_shards = 1;
+#endif
+        for (size_t i = 0; i < num_shards; ++i)
+            shards_.emplace_back(make_shard(port, num_shards > 1, use_uring));
         do_timer();
-        do_accept();
     }
 
     void run()
     {
-        if (thread_pool_size_ > 1) {
-            // Create a pool of threads to run all of the io_services.
-            std::vector<boost::shared_ptr<boost::thread>> threads;
-            for (std::size_t i = 0; i < thread_pool_size_; ++i) {
-                boost::shared_ptr<boost::thread> thread(new boost::thread(
-                    boost::bind(&boost::asio::io_service::run, &io_service_)));
-                threads.push_back(thread);
-            }
-
-            // Wait for all threads in the pool to exit.
-            for (std::size_t i = 0; i < threads.size(); ++i)
-                threads[i]->join();
-        } else {
-            io_service_.run();
+        // one thread per shard, while this one keeps the statistics
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            shard* sh = shards_[i].get();
+            threads.emplace_back([sh]() { sh->run(); });
+            pin_thread(threads.back(), i);
         }
+        io_service_.run();
+        for (size_t i = 0; i < shards_.size(); ++i)
+            shards_[i]->stop();
+        for (size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
     }
 
 protected:
@@ -409,6 +1172,44 @@ protected:
     uint64_t last_stat_rps_;
 
 private:
+    // falls back to asio, and stays with it, if io_uring can't be used
+    static shard* make_shard(unsigned short port, bool share_port, bool& use_uring)
+    {
+#if RAP_URING
+        if (use_uring) {
+            std::unique_ptr<uring_shard> sh(new uring_shard());
+            int err = sh->init(port, share_port);
+            if (err == 0)
+                return sh.release();
+            fprintf(PRINT_STREAM, "crapper: io_uring unavailable (%s), using asio\n", strerror(-err));
+            use_uring = false;
+        }
+#else
+        if (use_uring) {
+            fprintf(PRINT_STREAM, "crapper: built without io_uring, using asio\n");
+            use_uring = false;
+        }
+#endif
+        return new asio_shard(port, share_port);
+    }
+
+    // keeps the thread of shard n on core n, where supported
+    static void pin_thread(std::thread& t, size_t n)
+    {
+#ifdef __linux__
+        unsigned cores = std::thread::hardware_concurrency();
+        if (cores < 2)
+            return;
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(n % cores, &cpus);
+        pthread_setaffinity_np(t.native_handle(), sizeof(cpus), &cpus);
+#else
+        (void)t;
+        (void)n;
+#endif
+    }
+
     void do_timer()
     {
         timer_.expires_from_now(boost::posix_time::seconds(1));
@@ -416,28 +1217,6 @@ private:
             [this](const boost::system::error_code ec) { handle_timeout(ec); });
     }
 
-    void do_accept()
-    {
-        acceptor_.async_accept(socket_, [this](boost::system::error_code ec) {
-            if (!ec) {
-                boost::asio::ip::tcp::no_delay no_delay_option;
-                boost::asio::socket_base::receive_buffer_size
-                    receive_buffer_size_option;
-                boost::asio::socket_base::send_buffer_size send_buffer_size_option;
-                socket_.get_option(no_delay_option);
-                socket_.get_option(receive_buffer_size_option);
-                socket_.get_option(send_buffer_size_option);
-                fprintf(PRINT_STREAM,
-                    "connection established (no_delay %d, read_stream %d, send %d)\n",
-                    no_delay_option.value(),
-                    receive_buffer_size_option.value(),
-                    send_buffer_size_option.value());
-                std::make_shared<session>(std::move(socket_), stats_)->start();
-            }
-            do_accept();
-        });
-    }
-
     void handle_timeout(const boost::system::error_code& e)
     {
         if (e != boost::asio::error::operation_aborted) {
@@ -449,6 +1228,9 @@ private:
             unsigned long long stat_mbps_out_;
             unsigned long long stat_bytes_per_write_ = 0;
 
+            for (size_t i = 0; i < shards_.size(); ++i)
+                shards_[i]->stats().aggregate_into(stats_);
+
             n = stats_.head_count;
             stat_rps_ = n - last_head_count_;
             last_head_count_ = n;
@@ -487,24 +1269,41 @@ private:
 
     boost::asio::io_service io_service_;
     boost::asio::deadline_timer timer_;
-    tcp::acceptor acceptor_;
-    tcp::socket socket_;
+    std::vector<std::unique_ptr<shard>> shards_;
     rap::stats stats_;
-    size_t thread_pool_size_;
 };
 
 int main(int argc, char* argv[])
 {
     const char* port = "10111";
+    const char* threads = "1";
+    const char* backend = "asio";
     try {
-        if (argc == 2) {
+        if (argc >= 2) {
             port = argv[1];
         }
-        server s(static_cast<unsigned short>(std::atoi(port)));
+        if (argc >= 3) {
+            threads = argv[2];
+        }
+        if (argc >= 4) {
+            backend = argv[3];
+        }
+        if (const char* path = getenv("CRAPPER_TRACE")) {
+            trace_file = rap_tracer_create(path, trace_capacity, 0);
+            if (trace_file == nullptr)
+                fprintf(PRINT_STREAM, "crapper: can't trace to %s\n", path);
+#ifdef SIGUSR1
+            else
+                signal(SIGUSR1, toggle_trace);
+#endif
+        }
+        server s(static_cast<unsigned short>(std::atoi(port)),
+            static_cast<size_t>(std::atoi(threads)), strcmp(backend, "uring") == 0);
         s.run();
     } catch (std::exception& e) {
         fprintf(PRINT_STREAM, "Exception: %s\n", e.what());
     }
+    rap_tracer_destroy(trace_file);
 
     return 0;
 }
@@ -0,0 +1,309 @@
+/**
+ * @brief REST Aggregation Protocol trace decoder
+ *
+ * Prints the frames in a capture file written by a rap_tracer, such as
+ * the one crapper writes to $CRAPPER_TRACE, oldest first. Records are
+ * decoded with rap::reader, using the strings and routes each side has
+ * defined since tracing started.
+ *
+ * Usage: craptrace [-x] [-l link] file
+ *   -x       also dump frame payloads in hex
+ *   -l link  only print frames of this link
+ */
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rap.hpp"
+#include "rap_frame.h"
+#include "rap_header.h"
+#include "rap_kvv.hpp"
+#include "rap_reader.hpp"
+#include "rap_record.hpp"
+#include "rap_route.hpp"
+#include "rap_stringtable.hpp"
+#include "rap_text.hpp"
+#include "rap_trace.hpp"
+
+#if !RAP_TRACE
+int main()
+{
+    fprintf(stderr, "craptrace: built with RAP_TRACE=0\n");
+    return 1;
+}
+#else
+
+typedef rap::tracer::record trace_record;
+
+// what one side of a link has defined for the other
+struct tables {
+    rap::stringtable strings;
+    rap::routetable routes;
+};
+
+static bool dump_hex = false;
+
+static void print_hex(const char* src_ptr, const char* src_end)
+{
+    while (src_ptr < src_end) {
+        const char* p = src_ptr;
+        int n = 0;
+        printf("      ");
+        while (p < src_end && n++ < 16)
+            printf("%02x ", (*p++) & 0xFF);
+        while (n++ < 16)
+            printf("   ");
+        putchar(' ');
+        p = src_ptr;
+        n = 0;
+        while (p < src_end && n++ < 16) {
+            int ch = (*p++) & 0xFF;
+            putchar(isgraph(ch) ? ch : '.');
+        }
+        putchar('\n');
+        src_ptr += 16;
+    }
+}
+
+static void print_headers(const rap::headers& headers)
+{
+    std::string out;
+    headers.render(out);
+    size_t begin = 0;
+    while (begin < out.size()) {
+        size_t end = out.find('\n', begin);
+        printf("      %.*s\n", static_cast<int>(end - begin), out.data() + begin);
+        begin = end + 1;
+    }
+}
+
+static void print_request(rap::reader& r)
+{
+    rap::text method(r.read_text());
+    rap::text scheme(r.read_text());
+    rap::route route(r.read_route());
+    rap::query query(r);
+    rap::headers headers(r);
+    rap::text host(r.read_text());
+    int64_t content_length = r.read_int64();
+    if (r.error()) {
+        printf("    request, rap error %d\n", r.error());
+        return;
+    }
+    std::string out;
+    method.render(out);
+    out += ' ';
+    if (!scheme.empty()) {
+        scheme.render(out);
+        out += "://";
+    }
+    host.render(out);
+    route.render(out);
+    query.render(out);
+    printf("    %s content-length %lld\n", out.c_str(), static_cast<long long>(content_length));
+    print_headers(headers);
+}
+
+static void print_response(rap::reader& r)
+{
+    size_t code = r.read_length();
+    rap::headers headers(r);
+    int64_t content_length = r.read_int64();
+    if (r.error()) {
+        printf("    response, rap error %d\n", r.error());
+        return;
+    }
+    printf("    %u content-length %lld\n", static_cast<unsigned>(code), static_cast<long long>(content_length));
+    print_headers(headers);
+}
+
+// decodes a frame on the muxer connection, keeping the definitions
+static void print_muxer(const rap_frame* f, tables& t)
+{
+    rap::reader r(f);
+    unsigned char type = r.read_uchar();
+    switch (type) {
+    case rap::rap_frame_type_setup: {
+        unsigned long long max_frames = r.read_uint64();
+        printf("    setup max-frames %llu", max_frames);
+        if (!r.eof())
+            printf(" link-window %llu", static_cast<unsigned long long>(r.read_uint64()));
+        putchar('\n');
+        break;
+    }
+    case rap::rap_frame_type_credit:
+        printf("    credit %llu\n", static_cast<unsigned long long>(r.read_uint64()));
+        break;
+    case rap::rap_frame_type_set_string: {
+        unsigned key = r.eof() ? 0 : r.read_uchar();
+        size_t len = r.read_length();
+        if (r.error() || key < rap::stringtable::first_key || !len || len > r.size()) {
+            printf("    bad string definition\n");
+            break;
+        }
+        t.strings.set(key, r.data(), len);
+        printf("    string %02x = \"%.*s\"\n", key, static_cast<int>(len), r.data());
+        break;
+    }
+    case rap::rap_frame_type_set_route: {
+        size_t index = r.read_length();
+        size_t len = r.read_length();
+        if (r.error() || len > r.size()
+            || !t.routes.set(static_cast<uint16_t>(index), r.data(), len)) {
+            printf("    bad route definition\n");
+            break;
+        }
+        printf("    route %u = \"%.*s\"\n", static_cast<unsigned>(index), static_cast<int>(len), r.data());
+        break;
+    }
+    default:
+        printf("    unknown muxer frame %02x\n", type);
+        break;
+    }
+}
+
+static void print_frame(const rap_frame* f, size_t captured, tables& t)
+{
+    const rap_header& h = f->header();
+    if (h.id() == rap_muxer_conn_id)
+        printf("  muxer");
+    else
+        printf("  conn %04x", h.id());
+    if (h.is_ack()) {
+        printf(" ack %u\n", static_cast<unsigned>(h.ack_count()));
+        return;
+    }
+    if (h.has_head())
+        printf(" head");
+    if (h.is_final())
+        printf(" final");
+    else if (h.has_body())
+        printf(" body");
+    else if (!h.has_head())
+        printf(" empty");
+    printf(" %u bytes", static_cast<unsigned>(f->payload_size()));
+    if (captured < f->size()) {
+        printf(", %u captured\n", static_cast<unsigned>(captured));
+        return;
+    }
+    putchar('\n');
+    if (!f->has_payload())
+        return;
+    if (h.id() == rap_muxer_conn_id) {
+        print_muxer(f, t);
+    } else if (h.has_head()) {
+        rap::reader r(f, &t.strings, &t.routes);
+        rap::record::tag tag = r.read_tag();
+        if (tag == rap::record::tag_http_request)
+            print_request(r);
+        else if (tag == rap::record::tag_http_response)
+            print_response(r);
+        else
+            printf("    record %02x\n", static_cast<unsigned char>(tag));
+    }
+    if (dump_hex)
+        print_hex(f->payload(), f->payload() + f->payload_size());
+}
+
+static void print_entry(const trace_record* rec, std::map<uint64_t, tables>& links)
+{
+    time_t secs = static_cast<time_t>(rec->time_ns / 1000000000u);
+    struct tm tm;
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%H:%M:%S", localtime_r(&secs, &tm));
+    char rw = rec->dir == rap::tracer::dir_send ? 'W' : 'R';
+    printf("%s.%06u link %u %c %u bytes\n", stamp,
+        static_cast<unsigned>(rec->time_ns % 1000000000u / 1000u), rec->link, rw, rec->length);
+
+    tables& t = links[static_cast<uint64_t>(rec->link) << 1 | rec->dir];
+    const char* src_ptr = reinterpret_cast<const char*>(rec + 1);
+    const char* src_end = src_ptr + rec->size;
+    while (src_end - src_ptr >= rap_frame_header_size) {
+        const rap_frame* f = reinterpret_cast<const rap_frame*>(src_ptr);
+        size_t captured = static_cast<size_t>(src_end - src_ptr);
+        print_frame(f, captured, t);
+        if (captured < f->size())
+            break;
+        src_ptr += f->size();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    long link = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "xl:")) != -1) {
+        if (opt == 'x')
+            dump_hex = true;
+        else if (opt == 'l')
+            link = std::atol(optarg);
+        else
+            optind = argc + 1;
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: craptrace [-x] [-l link] file\n");
+        return 2;
+    }
+
+    const char* path = argv[optind];
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "craptrace: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    size_t map_size = static_cast<size_t>(st.st_size);
+    void* map = map_size >= sizeof(rap::tracer::file_header)
+        ? mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    close(fd);
+    const rap::tracer::file_header* hdr = static_cast<const rap::tracer::file_header*>(map);
+    if (map == MAP_FAILED || hdr->magic != rap::tracer::file_magic
+        || hdr->version != rap::tracer::file_version || hdr->capacity & (hdr->capacity - 1)
+        || map_size < sizeof(*hdr) + hdr->capacity) {
+        fprintf(stderr, "craptrace: %s: not a trace file\n", path);
+        return 1;
+    }
+
+    // walk from where the ring was last overwritten up to the head, finding
+    // entries by their position, which also skips any torn by a live writer
+    const char* ring = reinterpret_cast<const char*>(hdr + 1);
+    uint64_t cap = hdr->capacity;
+    uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    uint64_t pos = head > cap ? head - cap : 0;
+    std::map<uint64_t, tables> links;
+    while (pos < head) {
+        uint64_t room = cap - (pos & (cap - 1));
+        if (room < sizeof(trace_record)) {
+            pos += room;
+            continue;
+        }
+        const trace_record* rec = reinterpret_cast<const trace_record*>(ring + (pos & (cap - 1)));
+        if (__atomic_load_n(&rec->pos, __ATOMIC_ACQUIRE) != pos || rec->size > hdr->snaplen
+            || rap::tracer::entry_size(rec->size) > room) {
+            pos += rap::tracer::entry_align;
+            continue;
+        }
+        if (rec->dir == rap::tracer::dir_pad) {
+            pos += room;
+            continue;
+        }
+        if (link < 0 || rec->link == static_cast<unsigned long>(link))
+            print_entry(rec, links);
+        pos += rap::tracer::entry_size(rec->size);
+    }
+    munmap(map, map_size);
+    return 0;
+}
+
+#endif // RAP_TRACE
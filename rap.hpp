@@ -34,6 +34,9 @@ typedef enum {
     rap_frame_type_request = 0x02,
     rap_frame_type_response = 0x03,
     rap_frame_type_close = 0x04,
+    rap_frame_type_credit = 0x05,
+    rap_frame_type_set_string = 0x06,
+    rap_frame_type_set_route = 0x07,
     rap_frame_type_body = 0xff,
 } rap_frame_type;
 
@@ -57,6 +60,7 @@ class kvv;
 class conn;
 class net;
 class muxer;
+class tracer;
 
 } // namespace rap
 
@@ -66,4 +70,7 @@ typedef rap::muxer rap_muxer;
 #define RAP_CONN_DEFINED 1
 typedef rap::conn rap_conn;
 
+#define RAP_TRACER_DEFINED 1
+typedef rap::tracer rap_tracer;
+
 #endif // RAP_HPP
@@ -16,6 +16,26 @@ typedef void rap_conn;
 */
 typedef int (*rap_muxer_write_cb_t)(void* muxer_user_data, const char* p, int n);
 
+/*
+    A buffer for the vectored write callback. Has the same layout
+    as the POSIX struct iovec.
+*/
+typedef struct rap_iovec {
+    const void* iov_base;
+    size_t iov_len;
+} rap_iovec;
+
+/*
+    The vectored write network data callback.
+    Receives all output collected during a rap_muxer_recv() call, or
+    between rap_muxer_cork() and rap_muxer_uncork(), so that it can be
+    sent with a single writev() or sendmsg().
+    The buffer contents must be copied or fully sent before the call returns.
+    A nonzero return value indicates the network socket has been
+    closed and connection should terminate.
+*/
+typedef int (*rap_muxer_writev_cb_t)(void* muxer_user_data, const rap_iovec* iov, int iovcnt);
+
 /*
     One-time initialization of RAP connections. Called for a connection before
     it is allowed to process data. Use it to create instances of your own 
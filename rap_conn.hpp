@@ -7,8 +7,11 @@
 #include "rap_callbacks.h"
 #include "rap_constants.h"
 #include "rap_frame.h"
+#include "rap_framequeue.hpp"
 
 #include "rap_link.hpp"
+#include "rap_scheduler.hpp"
+#include "rap_window.hpp"
 
 namespace rap {
 
@@ -18,15 +21,15 @@ public:
         : link_(nullptr)
         , conn_cb_(nullptr)
         , conn_cb_param_(nullptr)
-        , queue_(nullptr)
         , id_(rap_muxer_conn_id)
-        , send_window_(0)
+        , ack_pending_(0)
+        , credit_wait_(false)
         , local_sent_final_(false)
         , remote_sent_final_(false)
     {
     }
 
-    int init(rap::link* link, rap_conn_id id, int send_window,
+    int init(rap::link* link, rap_conn_id id, const window_limits& limits,
         rap_conn_cb_t conn_cb, void* conn_cb_param)
     {
         if (!link || id > rap_max_conn_id)
@@ -34,9 +37,11 @@ public:
         link_ = link;
         conn_cb_ = conn_cb;
         conn_cb_param_ = conn_cb_param;
-        queue_ = nullptr;
+        assert(queue_.empty());
         id_ = id;
-        send_window_ = static_cast<int16_t>(send_window);
+        window_.init(limits, rap_max_send_window);
+        ack_pending_ = 0;
+        credit_wait_ = false;
         local_sent_final_ = false;
         remote_sent_final_ = false;
 
@@ -50,8 +55,8 @@ public:
 
     virtual ~conn()
     {
-        while (queue_)
-            framelink::dequeue(&queue_);
+        if (link_)
+            queue_.clear(link_->slabs());
         id_ = rap_muxer_conn_id;
     }
 
@@ -72,17 +77,32 @@ public:
 
     error write_frame(const rap_frame* f)
     {
-        if (error e = write_queue())
-            return e;
-        if (send_window_ < 1) {
-#ifndef NDEBUG
-            fprintf(stderr, "conn %04x waiting for ack\n", id_);
-            fflush(stderr);
-#endif
-            framelink::enqueue(&queue_, f);
-            return rap_err_ok;
-        }
-        return send_frame(f);
+        if (queue_.empty() && !link_->corked()
+            && (f->header().is_flow()
+                   || (link_->has_credit() && window_.can_send(f->payload_size()))))
+            return send_frame(f);
+        if (!queue_.enqueue(link_->slabs(), f))
+            return rap_err_output_buffer_too_small;
+        link_->cork();
+        schedule();
+        return link_->uncork() ? rap_err_output_buffer_too_small : rap_err_ok;
+    }
+
+    /**
+     * @brief write_shared() queues a frame from rap::framepool by
+     * reference, so the same payload can be sent on many connections
+     * without copying it. The connection id in the frame header is
+     * replaced with our own.
+     */
+    error write_shared(const rap_frame* f)
+    {
+        rap_header h = f->header();
+        h.set_id(id_);
+        if (!queue_.enqueue_shared(link_->slabs(), h, f))
+            return rap_err_output_buffer_too_small;
+        link_->cork();
+        schedule();
+        return link_->uncork() ? rap_err_output_buffer_too_small : rap_err_ok;
     }
 
     bool process_frame(const rap_frame* f, int len, error& ec)
@@ -90,72 +110,210 @@ public:
         if (f->header().is_flow())
         {
             if (f->header().is_ack()) {
-                ++send_window_;
-                ec = write_queue();
+                window_.on_ack(f->header().ack_count());
+                if (!queue_.empty())
+                    schedule();
                 return true;
             } else if (f->header().is_final()) {
                 assert(!remote_sent_final_);
                 remote_sent_final_ = true;
+                end_exchange();
             }
         }
         if (conn_cb_)
             conn_cb_(conn_cb_param_, this, f, len);
-        if ((ec = send_ack())) {
+        if (f->header().is_flow())
+            return true;
+        if ((ec = ack_frame())) {
             assert(!ec);
             return false;
         }
         return true;
     }
 
+    /**
+     * @brief flush_ack() sends a single ACK covering all frames received
+     * since the last one was sent, if any.
+     */
+    error flush_ack()
+    {
+        if (!ack_pending_)
+            return rap_err_ok;
+        set_ack_count();
+        return write(ack_, sizeof(ack_)) ? rap_err_output_buffer_too_small
+                                         : rap_err_ok;
+    }
+
+    /**
+     * @brief next_frame() returns the next queued frame if the send
+     * window allows sending it, otherwise nullptr.
+     */
+    const rap_frame* next_frame()
+    {
+        const rap_frame* f = queue_.peek();
+        if (f != nullptr && !f->header().is_flow()) {
+            if (!link_->has_credit()) {
+                if (!credit_wait_) {
+                    credit_wait_ = true;
+                    link_->wait_credit(id_);
+                }
+                return nullptr;
+            }
+            if (!window_.can_send(f->payload_size()))
+                return nullptr;
+        }
+        return f;
+    }
+
+    /**
+     * @brief wake() is called when the link has gotten more credit
+     * after next_frame() found it exhausted.
+     */
+    void wake()
+    {
+        credit_wait_ = false;
+        if (!queue_.empty())
+            schedule();
+    }
+
+    /**
+     * @brief send_next() writes the frame returned by next_frame() to
+     * the link output. The frame stays queued until the link calls
+     * release_output().
+     */
+    error send_next()
+    {
+        const rap_frame* f = queue_.peek();
+        assert(f != nullptr);
+        const rap_frame* shared = queue_.peek_shared();
+        queue_.advance();
+        sent(f);
+        int rv;
+        if (shared != nullptr) {
+            rv = link_->write_ref(id_, f->data(), rap_frame_header_size,
+                shared->payload(), shared->payload_size());
+        } else {
+            rv = link_->write_ref(id_, f->data(), f->size());
+        }
+        if (rv)
+            return rap_err_output_buffer_too_small;
+        return rap_err_ok;
+    }
+
+    /**
+     * @brief release_output() drops the queued frames that have been written.
+     */
+    void release_output() { queue_.release(link_->slabs()); }
+
+    /**
+     * @brief set_priority() sets the output priority level, zero being
+     * the highest, and the share of bandwidth relative to other
+     * connections on the same level.
+     */
+    int set_priority(int priority, int weight)
+    {
+        if (priority < 0 || priority > rap_max_priority || weight < 1)
+            return -1;
+        sched_.priority = priority;
+        sched_.weight = weight;
+        return 0;
+    }
+
+    sched_state& sched() { return sched_; }
+
+    /**
+     * @brief idle() checks that there are no queued frames waiting to
+     * be written to the link.
+     */
+    bool idle() { return queue_.peek() == nullptr; }
+
+    const stringtable& strings() const { return link_->strings(); }
+    const stringtable& send_strings() const { return link_->send_strings(); }
+    const routetable& routes() const { return link_->routes(); }
+
     rap_conn_id id() const { return id_; }
-    int16_t send_window() const { return send_window_; }
+    int send_window() const { return window_.available(); }
+    rap::window& window() { return window_; }
     int write(const char* p, int n) const { return link_->write(p, n); }
 
 private:
     rap::link* link_;
     rap_conn_cb_t conn_cb_;
     void* conn_cb_param_;
-    framelink* queue_;
+    framequeue queue_;
     rap_conn_id id_;
-    int16_t send_window_;
+    rap::window window_;
+    sched_state sched_;
+    uint16_t ack_pending_;
     char ack_[4];
+    bool credit_wait_;
     bool local_sent_final_;
     bool remote_sent_final_;
 
-    error write_queue()
+    error send_frame(const rap_frame* f)
     {
-        while (queue_ != nullptr) {
-            rap_frame* f = reinterpret_cast<rap_frame*>(queue_ + 1);
-            if (!f->header().is_flow() && send_window_ < 1)
-                return rap_err_ok;
-            if (error e = send_frame(f))
-                return e;
-            framelink::dequeue(&queue_);
+        int rv;
+        if (ack_pending_ && f->size() <= rap_max_ack_piggyback) {
+            // piggyback the pending ACK on the outbound frame
+            set_ack_count();
+            rv = link_->write(ack_, sizeof(ack_), f->data(), static_cast<int>(f->size()));
+        } else {
+            rv = write(f->data(), static_cast<int>(f->size()));
         }
+        if (rv) {
+            assert("rap::conn::send_frame(): muxer_.write() failed" == nullptr);
+            return rap_err_output_buffer_too_small;
+        }
+        sent(f);
         return rap_err_ok;
     }
 
-    error send_frame(const rap_frame* f)
+    void sent(const rap_frame* f)
     {
-        if (write(f->data(), static_cast<int>(f->size()))) {
-            assert("rap::conn::send_frame(): muxer_.write() failed" == nullptr);
-            return rap_err_output_buffer_too_small;
-        }
         if (f->header().is_flow()) {
             if (f->header().is_final()) {
                 assert(!local_sent_final_);
                 local_sent_final_ = true;
+                end_exchange();
             }
         } else {
-            --send_window_;
+            window_.on_send(f->payload_size());
+            link_->use_credit(f->size());
         }
+    }
+
+    // once both sides have sent their final frame, the connection
+    // is free to carry the next request
+    void end_exchange()
+    {
+        if (local_sent_final_ && remote_sent_final_) {
+            local_sent_final_ = false;
+            remote_sent_final_ = false;
+        }
+    }
+
+    void schedule()
+    {
+        assert(link_->scheduler() != nullptr);
+        link_->scheduler()->ready(this);
+    }
+
+    // counts a received frame as needing an ACK, which is sent when the
+    // link is done with the current batch or the threshold is reached
+    error ack_frame()
+    {
+        if (++ack_pending_ == 1)
+            link_->defer_ack(id_);
+        if (ack_pending_ >= rap_max_ack_delay)
+            return flush_ack();
         return rap_err_ok;
     }
 
-    error send_ack()
+    void set_ack_count()
     {
-        return write(ack_, sizeof(ack_)) ? rap_err_output_buffer_too_small
-                                         : rap_err_ok;
+        assert(ack_pending_ > 0);
+        reinterpret_cast<rap_header*>(ack_)->set_size_value(ack_pending_);
+        ack_pending_ = 0;
     }
 };
 
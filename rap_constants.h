@@ -7,7 +7,15 @@ enum {
     rap_muxer_conn_id = rap_conn_id(0x1fff), /**< ID used in frames for a muxer connection. */
     rap_max_conn_id = rap_muxer_conn_id - 1, /**< The highest allowed connection ID. */
     rap_frame_header_size = 4, /**< Number of octets in a rap frame header. */
-    rap_max_send_window = 8 /**< maximum send window size */
+    rap_max_send_window = 8, /**< send window size used until the peer has sent a setup frame */
+    rap_max_send_window_limit = 64, /**< upper bound for a negotiated send window */
+    rap_max_ack_delay = rap_max_send_window / 2, /**< received frames after which an ACK is sent without waiting for the batch to end */
+    rap_max_ack_piggyback = 0x1000, /**< largest outbound frame a pending ACK is coalesced with */
+    rap_max_cork_size = 0x40000, /**< output collected while corked before it is written anyway */
+    rap_max_priority = 3, /**< lowest output priority level, zero being the highest */
+    rap_link_window = 0x800000, /**< default number of bytes the peer may have in flight over a link */
+    rap_string_table_size = 0x1000, /**< default byte budget of the strings defined for the peer */
+    rap_max_routes = 0x1000 /**< maximum number of route templates defined for the peer */
 };
 
 #endif /* RAP_CONSTANTS_H */
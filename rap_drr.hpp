@@ -0,0 +1,105 @@
+#ifndef RAP_DRR_HPP
+#define RAP_DRR_HPP
+
+#include <cassert>
+#include <cstdint>
+
+#include "rap.hpp"
+#include "rap_conn.hpp"
+#include "rap_constants.h"
+#include "rap_frame.h"
+#include "rap_scheduler.hpp"
+
+namespace rap {
+
+/**
+ * @brief drr_scheduler is a deficit round-robin scheduler with strict
+ * priority levels.
+ *
+ * Ready connections on a higher priority level (lower number) are
+ * served before any on a lower one. Within a level, each round gives a
+ * connection a quantum of rap_frame_max_size bytes times its weight,
+ * so a connection streaming large frames can't crowd out the small
+ * frames of others sharing the link.
+ */
+class drr_scheduler : public scheduler {
+public:
+    drr_scheduler()
+    {
+        for (int i = 0; i < rap_max_priority + 1; ++i) {
+            head_[i] = nullptr;
+            tail_[i] = nullptr;
+        }
+    }
+
+    void ready(rap::conn* c);
+    void run();
+
+private:
+    rap::conn* head_[rap_max_priority + 1];
+    rap::conn* tail_[rap_max_priority + 1];
+
+    void push(rap::conn* c);
+    rap::conn* pop(int level);
+};
+
+inline void drr_scheduler::ready(rap::conn* c)
+{
+    if (!c->sched().queued)
+        push(c);
+}
+
+inline void drr_scheduler::run()
+{
+    for (int level = 0; level <= rap_max_priority; ++level) {
+        while (rap::conn* c = pop(level)) {
+            sched_state& st = c->sched();
+            st.deficit += static_cast<size_t>(rap_frame_max_size) * static_cast<size_t>(st.weight);
+            bool failed = false;
+            while (const rap_frame* f = c->next_frame()) {
+                if (f->size() > st.deficit)
+                    break;
+                st.deficit -= f->size();
+                if (c->send_next()) {
+                    failed = true;
+                    break;
+                }
+            }
+            if (!failed && c->next_frame() != nullptr)
+                push(c);
+            else
+                st.deficit = 0;
+        }
+    }
+}
+
+inline void drr_scheduler::push(rap::conn* c)
+{
+    sched_state& st = c->sched();
+    int level = st.priority < 0 ? 0 : (st.priority > rap_max_priority ? int(rap_max_priority) : st.priority);
+    st.next = nullptr;
+    st.queued = true;
+    if (tail_[level] != nullptr)
+        tail_[level]->sched().next = c;
+    else
+        head_[level] = c;
+    tail_[level] = c;
+}
+
+inline rap::conn* drr_scheduler::pop(int level)
+{
+    rap::conn* c = head_[level];
+    if (c != nullptr) {
+        sched_state& st = c->sched();
+        head_[level] = st.next;
+        if (head_[level] == nullptr)
+            tail_[level] = nullptr;
+        st.next = nullptr;
+        st.queued = false;
+    }
+    return c;
+}
+
+} // namespace rap
+
+#endif // RAP_DRR_HPP
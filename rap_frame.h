@@ -19,25 +19,6 @@ struct rap_frame {
         return reinterpret_cast<const rap_header*>(src_ptr)->size();
     }
 
-    static rap_frame* factory(const char* src_ptr, size_t src_len)
-    {
-        assert(src_ptr != NULL);
-        assert(rap_frame_header_size <= src_len);
-        assert(needed_bytes(src_ptr) == src_len);
-        return reinterpret_cast<const rap_frame*>(src_ptr)->copy();
-    }
-
-    rap_frame* copy() const
-    {
-        size_t src_len = size();
-        if (rap_frame* f = static_cast<rap_frame*>(malloc(src_len))) {
-            memcpy(f, this, src_len);
-            assert(f->size() == src_len);
-            return f;
-        }
-        return NULL;
-    }
-
     const rap_header& header() const
     {
         return *reinterpret_cast<const rap_header*>(this);
@@ -53,36 +34,93 @@ struct rap_frame {
     char* payload() { return data() + rap_frame_header_size; }
 };
 
-struct framelink {
-    static void enqueue(framelink** pp_fl, const rap_frame* f)
+/*
+ * A frameslab is a contiguous block of memory holding queued frames
+ * back to back. Frames are appended at tail and consumed from head.
+ */
+struct frameslab {
+    frameslab* next;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+    const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+    size_t room() const { return capacity - tail; }
+    bool empty() const { return head == tail; }
+};
+
+/*
+ * slabpool recycles frameslabs for all the framequeues of a link,
+ * so that queueing frames doesn't touch the allocator in steady state.
+ * Slabs come in two sizes; small ones for the common case of short
+ * frames and large ones that can always hold a maximum sized frame.
+ */
+class slabpool {
+public:
+    enum {
+        small_slab_size = 0x1000 - sizeof(frameslab), /**< Capacity of a small slab. */
+        large_slab_size = rap_frame_max_size + 16, /**< Capacity of a large slab, fits any queue entry. */
+        max_free_slabs = 16 /**< Maximum number of free slabs kept per size. */
+    };
+
+    slabpool()
     {
-        if (f != NULL) {
-            size_t framesize = f->size();
-            if (framelink* p_fl = reinterpret_cast<framelink*>(
-                    malloc(sizeof(framelink) + framesize))) {
-                p_fl->next = NULL;
-                memcpy(p_fl + 1, f, framesize);
-                while (*pp_fl)
-                    pp_fl = &((*pp_fl)->next);
-                *pp_fl = p_fl;
-            }
+        for (int i = 0; i < 2; ++i) {
+            free_[i] = nullptr;
+            free_count_[i] = 0;
         }
     }
 
-    static void dequeue(framelink** pp_fl)
+    ~slabpool()
     {
-        while (framelink* p_fl = *pp_fl) {
-            if (p_fl->next == NULL) {
-                *pp_fl = NULL;
-                free(p_fl);
-                return;
+        for (int i = 0; i < 2; ++i) {
+            while (frameslab* slab = free_[i]) {
+                free_[i] = slab->next;
+                free(slab);
             }
-            pp_fl = &(p_fl->next);
         }
-        return;
     }
 
-    framelink* next;
+    frameslab* acquire(size_t min_capacity)
+    {
+        assert(min_capacity <= large_slab_size);
+        int i = min_capacity > small_slab_size ? 1 : 0;
+        frameslab* slab = free_[i];
+        if (slab != nullptr) {
+            free_[i] = slab->next;
+            --free_count_[i];
+        } else {
+            size_t capacity = i ? large_slab_size : small_slab_size;
+            slab = static_cast<frameslab*>(malloc(sizeof(frameslab) + capacity));
+            if (slab == nullptr)
+                return nullptr;
+            slab->capacity = capacity;
+        }
+        slab->next = nullptr;
+        slab->head = 0;
+        slab->tail = 0;
+        return slab;
+    }
+
+    void release(frameslab* slab)
+    {
+        int i = slab->capacity > small_slab_size ? 1 : 0;
+        if (free_count_[i] >= max_free_slabs) {
+            free(slab);
+            return;
+        }
+        slab->next = free_[i];
+        free_[i] = slab;
+        ++free_count_[i];
+    }
+
+private:
+    frameslab* free_[2];
+    size_t free_count_[2];
+
+    slabpool(const slabpool&);
+    slabpool& operator=(const slabpool&);
 };
 
 #endif // RAP_FRAME_H
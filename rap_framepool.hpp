@@ -0,0 +1,326 @@
+#ifndef RAP_FRAMEPOOL_HPP
+#define RAP_FRAMEPOOL_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include "rap.hpp"
+#include "rap_frame.h"
+
+namespace rap {
+
+/**
+ * @brief framepool allocates frames that live outside of a link's
+ * receive buffer, such as frames built by C callers or copies kept
+ * past a callback.
+ *
+ * Frames come in a few size classes. Freed frames go to a cache owned
+ * by the calling thread, and only when a cache runs empty or grows too
+ * large are frames moved to or from the shared depot, batch_size at a
+ * time under a lock. The system allocator is only used while the pool
+ * is warming up.
+ *
+ * Each frame is preceded by a framepool::block holding its size class,
+ * the state used while building it and a reference count, so that a
+ * frame can be queued on several connections or kept by several owners
+ * without copying it. Once shared, a frame must not be modified.
+ */
+class framepool {
+public:
+    enum {
+        num_classes = 5,
+        batch_size = 32,
+        max_cached = batch_size * 2, /**< per size class and thread */
+        max_depot = batch_size * 32, /**< per size class */
+    };
+
+    struct block {
+        block* next;
+        uint32_t size_class;
+        uint32_t limit; /**< payload bytes the frame may hold */
+        char* cur; /**< where the next payload byte is written */
+        rap::error error;
+        std::atomic<int> refs;
+
+        rap_frame* frame() { return reinterpret_cast<rap_frame*>(this + 1); }
+
+        static block* of(const rap_frame* f)
+        {
+            return const_cast<block*>(reinterpret_cast<const block*>(f) - 1);
+        }
+    };
+
+    /**
+     * @brief create() returns an empty body frame that can hold up to
+     * @a payload_max_size bytes of payload, or nullptr.
+     */
+    static rap_frame* create(size_t payload_max_size)
+    {
+        if (payload_max_size > rap_frame_max_payload_size)
+            return nullptr;
+        uint32_t c = size_class(payload_max_size + rap_frame_header_size);
+        block* b = local().acquire(c);
+        if (b == nullptr)
+            return nullptr;
+        b->limit = static_cast<uint32_t>(payload_max_size);
+        b->error = rap_err_ok;
+        b->refs.store(1, std::memory_order_relaxed);
+        rap_frame* f = b->frame();
+        f->header() = rap_header();
+        f->header().set_body();
+        b->cur = f->payload();
+        return f;
+    }
+
+    /**
+     * @brief copy() returns a pooled copy of @a src, or nullptr.
+     */
+    static rap_frame* copy(const rap_frame* src)
+    {
+        assert(src != nullptr);
+        rap_frame* f = create(src->payload_size());
+        if (f != nullptr) {
+            memcpy(f, src, src->size());
+            block::of(f)->cur = f->payload() + f->payload_size();
+        }
+        return f;
+    }
+
+    /**
+     * @brief retain() adds a reference to a frame from create() or copy().
+     */
+    static rap_frame* retain(const rap_frame* f)
+    {
+        assert(f != nullptr);
+        block* b = block::of(f);
+        assert(b->refs.load(std::memory_order_relaxed) > 0);
+        b->refs.fetch_add(1, std::memory_order_relaxed);
+        return b->frame();
+    }
+
+    /**
+     * @brief destroy() drops a reference to a frame from create() or
+     * copy(), returning it to the pool when it was the last one.
+     */
+    static void destroy(const rap_frame* f)
+    {
+        if (f == nullptr)
+            return;
+        block* b = block::of(f);
+        assert(b->refs.load(std::memory_order_relaxed) > 0);
+        if (b->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            local().release(b);
+    }
+
+    static int refs(const rap_frame* f)
+    {
+        return block::of(f)->refs.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct freelist {
+        freelist()
+            : head(nullptr)
+            , count(0)
+        {
+        }
+
+        block* head;
+        size_t count;
+
+        void push(block* b)
+        {
+            b->next = head;
+            head = b;
+            ++count;
+        }
+
+        block* pop()
+        {
+            block* b = head;
+            if (b != nullptr) {
+                head = b->next;
+                --count;
+            }
+            return b;
+        }
+
+        // moves up to n blocks to the front of other
+        void move(freelist& other, size_t n)
+        {
+            while (n-- > 0 && head != nullptr)
+                other.push(pop());
+        }
+
+        void free_all()
+        {
+            while (block* b = pop())
+                free(b);
+        }
+    };
+
+    class depot {
+    public:
+        ~depot()
+        {
+            for (int c = 0; c < num_classes; ++c)
+                lists_[c].free_all();
+        }
+
+        void get(uint32_t c, freelist& dst)
+        {
+            std::lock_guard<std::mutex> g(mtx_);
+            lists_[c].move(dst, batch_size);
+        }
+
+        void put(uint32_t c, freelist& src, size_t n)
+        {
+            freelist excess;
+            {
+                std::lock_guard<std::mutex> g(mtx_);
+                size_t room = max_depot - lists_[c].count;
+                if (n > room) {
+                    src.move(excess, n - room);
+                    n = room;
+                }
+                src.move(lists_[c], n);
+            }
+            excess.free_all();
+        }
+
+    private:
+        std::mutex mtx_;
+        freelist lists_[num_classes];
+    };
+
+    class cache {
+    public:
+        ~cache()
+        {
+            for (uint32_t c = 0; c < num_classes; ++c)
+                shared().put(c, lists_[c], lists_[c].count);
+        }
+
+        block* acquire(uint32_t c)
+        {
+            freelist& fl = lists_[c];
+            if (fl.head == nullptr)
+                shared().get(c, fl);
+            if (block* b = fl.pop())
+                return b;
+            void* p = malloc(sizeof(block) + class_size(c));
+            if (p == nullptr)
+                return nullptr;
+            block* b = new (p) block;
+            b->size_class = c;
+            return b;
+        }
+
+        void release(block* b)
+        {
+            uint32_t c = b->size_class;
+            assert(c < num_classes);
+            freelist& fl = lists_[c];
+            fl.push(b);
+            if (fl.count > max_cached)
+                shared().put(c, fl, batch_size);
+        }
+
+    private:
+        freelist lists_[num_classes];
+    };
+
+    static depot& shared()
+    {
+        static depot d;
+        return d;
+    }
+
+    static cache& local()
+    {
+        static thread_local cache c;
+        return c;
+    }
+
+    static size_t class_size(uint32_t c)
+    {
+        return c + 1 < num_classes ? size_t(0x100) << (c * 2) : size_t(rap_frame_max_size);
+    }
+
+    static uint32_t size_class(size_t n)
+    {
+        uint32_t c = 0;
+        while (class_size(c) < n)
+            ++c;
+        return c;
+    }
+};
+
+/**
+ * @brief frameref is an owning handle to a pooled frame.
+ *
+ * Copies share the frame, and the last one to go returns it to the pool.
+ * Frames received on a link live in the caller's receive buffer, so
+ * keeping one past the callback takes a single copy(); after that it can
+ * be held and queued on any number of connections for free.
+ */
+class frameref {
+public:
+    frameref()
+        : f_(nullptr)
+    {
+    }
+
+    frameref(const frameref& other)
+        : f_(other.f_ ? framepool::retain(other.f_) : nullptr)
+    {
+    }
+
+    ~frameref() { framepool::destroy(f_); }
+
+    frameref& operator=(const frameref& other)
+    {
+        if (other.f_)
+            framepool::retain(other.f_);
+        framepool::destroy(f_);
+        f_ = other.f_;
+        return *this;
+    }
+
+    /**
+     * @brief adopt() takes over the reference a frame from
+     * framepool::create() was returned with.
+     */
+    static frameref adopt(rap_frame* f)
+    {
+        frameref r;
+        r.f_ = f;
+        return r;
+    }
+
+    static frameref copy(const rap_frame* f) { return adopt(framepool::copy(f)); }
+
+    rap_frame* get() const { return f_; }
+    const rap_frame* operator->() const { return f_; }
+    const rap_frame& operator*() const { return *f_; }
+    explicit operator bool() const { return f_ != nullptr; }
+
+    rap_frame* release()
+    {
+        rap_frame* f = f_;
+        f_ = nullptr;
+        return f;
+    }
+
+private:
+    rap_frame* f_;
+};
+
+} // namespace rap
+
+#endif // RAP_FRAMEPOOL_HPP
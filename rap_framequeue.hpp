@@ -0,0 +1,210 @@
+#ifndef RAP_FRAMEQUEUE_HPP
+#define RAP_FRAMEQUEUE_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include "rap_frame.h"
+#include "rap_framepool.hpp"
+
+namespace rap {
+
+/*
+ * framequeue is a FIFO of frames stored in a chain of pooled slabs.
+ * Both enqueue() and dequeue() are O(1).
+ *
+ * A frame is either copied into the slab, or for frames from the
+ * framepool, only its header is, along with a reference to the shared
+ * payload that is dropped when the frame is dequeued.
+ *
+ * Frames can also be handed out in order with peek() and advance() while
+ * staying in the queue, so that they can be written without copying them.
+ * Once written, release() dequeues everything that was advanced past.
+ */
+class framequeue {
+public:
+    framequeue()
+        : head_(nullptr)
+        , tail_(nullptr)
+        , cur_(nullptr)
+        , cur_off_(0)
+    {
+    }
+
+    ~framequeue() { assert(empty()); }
+
+    bool empty() const { return head_ == nullptr; }
+
+    bool enqueue(slabpool& pool, const rap_frame* f)
+    {
+        assert(f != nullptr);
+        size_t framesize = f->size();
+        char* p = reserve(pool, sizeof(entry) + framesize);
+        if (p == nullptr)
+            return false;
+        entry e = { 0 };
+        memcpy(p, &e, sizeof(e));
+        memcpy(p + sizeof(e), f, framesize);
+        return true;
+    }
+
+    /*
+     * Queues a reference to the payload of the pooled frame @a shared,
+     * to be sent with the header @a h.
+     */
+    bool enqueue_shared(slabpool& pool, const rap_header& h, const rap_frame* shared)
+    {
+        assert(shared != nullptr);
+        char* p = reserve(pool, sizeof(entry) + sizeof(rap_header) + sizeof(shared));
+        if (p == nullptr)
+            return false;
+        entry e = { 1 };
+        memcpy(p, &e, sizeof(e));
+        memcpy(p + sizeof(e), &h, sizeof(h));
+        framepool::retain(shared);
+        memcpy(p + sizeof(e) + sizeof(h), &shared, sizeof(shared));
+        return true;
+    }
+
+    /*
+     * Returns the header of the first frame. The payload follows
+     * it unless shared() returns non-nullptr for the same offset.
+     */
+    const rap_frame* front() const
+    {
+        assert(!empty());
+        return frame_at(head_, head_->head);
+    }
+
+    /*
+     * Returns the first frame not yet advanced past, or nullptr.
+     */
+    const rap_frame* peek()
+    {
+        if (cur_ == nullptr) {
+            if (head_ == nullptr)
+                return nullptr;
+            cur_ = head_;
+            cur_off_ = head_->head;
+        }
+        if (cur_off_ >= cur_->tail) {
+            if (cur_->next == nullptr)
+                return nullptr;
+            cur_ = cur_->next;
+            cur_off_ = cur_->head;
+        }
+        return frame_at(cur_, cur_off_);
+    }
+
+    /*
+     * Returns the shared frame holding the payload for the frame returned
+     * by peek(), or nullptr if the payload follows the header.
+     */
+    const rap_frame* peek_shared()
+    {
+        assert(peek() != nullptr);
+        return shared_at(cur_, cur_off_);
+    }
+
+    void advance()
+    {
+        assert(peek() != nullptr);
+        cur_off_ += entry_size(cur_, cur_off_);
+    }
+
+    bool advanced() const { return cur_ != nullptr; }
+
+    /*
+     * Dequeues all frames advanced past.
+     */
+    void release(slabpool& pool)
+    {
+        if (cur_ == nullptr)
+            return;
+        while (head_ != cur_)
+            dequeue(pool);
+        while (head_ != nullptr && head_ == cur_ && head_->head < cur_off_)
+            dequeue(pool);
+        cur_ = nullptr;
+    }
+
+    void dequeue(slabpool& pool)
+    {
+        assert(!empty());
+        framepool::destroy(shared_at(head_, head_->head));
+        head_->head += entry_size(head_, head_->head);
+        assert(head_->head <= head_->tail);
+        if (head_->empty()) {
+            frameslab* slab = head_;
+            head_ = slab->next;
+            if (head_ == nullptr)
+                tail_ = nullptr;
+            pool.release(slab);
+        }
+    }
+
+    void clear(slabpool& pool)
+    {
+        cur_ = nullptr;
+        while (!empty())
+            dequeue(pool);
+    }
+
+private:
+    struct entry {
+        uint32_t shared;
+    };
+
+    frameslab* head_;
+    frameslab* tail_;
+    frameslab* cur_;
+    size_t cur_off_;
+
+    char* reserve(slabpool& pool, size_t n)
+    {
+        if (tail_ == nullptr || tail_->room() < n) {
+            frameslab* slab = pool.acquire(n);
+            if (slab == nullptr)
+                return nullptr;
+            if (tail_ != nullptr)
+                tail_->next = slab;
+            else
+                head_ = slab;
+            tail_ = slab;
+        }
+        char* p = tail_->data() + tail_->tail;
+        tail_->tail += n;
+        return p;
+    }
+
+    static const rap_frame* frame_at(const frameslab* slab, size_t off)
+    {
+        return reinterpret_cast<const rap_frame*>(slab->data() + off + sizeof(entry));
+    }
+
+    static const rap_frame* shared_at(const frameslab* slab, size_t off)
+    {
+        entry e;
+        memcpy(&e, slab->data() + off, sizeof(e));
+        if (!e.shared)
+            return nullptr;
+        const rap_frame* f;
+        memcpy(&f, slab->data() + off + sizeof(e) + sizeof(rap_header), sizeof(f));
+        return f;
+    }
+
+    static size_t entry_size(const frameslab* slab, size_t off)
+    {
+        if (shared_at(slab, off) != nullptr)
+            return sizeof(entry) + sizeof(rap_header) + sizeof(const rap_frame*);
+        return sizeof(entry) + frame_at(slab, off)->size();
+    }
+
+    framequeue(const framequeue&);
+    framequeue& operator=(const framequeue&);
+};
+
+} // namespace rap
+
+#endif // RAP_FRAMEQUEUE_HPP
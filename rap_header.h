@@ -58,12 +58,15 @@ struct rap_header {
     }
     void set_id(uint16_t id)
     {
-        buf_[2] = static_cast<unsigned char>(id >> 8) & mask_id;
+        buf_[2] = (buf_[2] & mask_all) | (static_cast<unsigned char>(id >> 8) & mask_id);
         buf_[3] = static_cast<unsigned char>(id);
     }
 
     bool is_flow() const { return (buf_[2] & mask_flow) == mask_flow; }
     bool is_ack() const { return (buf_[2] & mask_all) == mask_flow; }
+    // an ACK carries the number of frames it acknowledges in the size
+    // field, zero meaning one
+    size_t ack_count() const { return size_value() ? size_value() : 1; }
     bool is_conn_control() const { return buf_[2] == mask_id && buf_[3] == 0xff; }
     bool is_final() const { return (buf_[2] & (mask_flow|mask_body)) == (mask_flow|mask_body); }
     void set_final() { buf_[2] |= (mask_flow|mask_body); }
@@ -0,0 +1,458 @@
+#ifndef RAP_HTTP_HPP
+#define RAP_HTTP_HPP
+
+#include "rap.hpp"
+#include "rap_kvv.hpp"
+#include "rap_route.hpp"
+#include "rap_text.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+namespace rap {
+
+/**
+ * @brief http serializes requests and responses as HTTP/1.1 message
+ * heads, including the empty line that ends them. Responses of unknown
+ * length are announced as chunked, see put_chunk_size().
+ *
+ * The same code produces the exact size, the bytes, or a gather list,
+ * by running it against different sinks. Gather lists point into the
+ * frame the message was read from and into static tables, so they are
+ * only valid while both the frame and the gather object are.
+ *
+ * Works with rap::request, rap::request_view and rap::response.
+ */
+class http {
+public:
+    enum {
+        max_uint64_digits = 20,
+        max_chunk_line = 18
+    };
+
+    /**
+     * @brief chunk is a generic gather list entry.
+     */
+    struct chunk {
+        const char* data;
+        size_t size;
+    };
+
+    template <typename Msg>
+    static size_t size(const Msg& msg)
+    {
+        counter c;
+        emit(c, msg);
+        return c.n;
+    }
+
+    /**
+     * @brief write() writes @a msg to @a p, which must have room for
+     * size(@a msg) bytes, and returns the end of the output.
+     */
+    template <typename Msg>
+    static char* write(char* p, const Msg& msg)
+    {
+        buffer b = { p };
+        emit(b, msg);
+        return b.p;
+    }
+
+    /**
+     * @brief write() writes @a msg to [@a p, @a end), returning the end
+     * of the output or nullptr if it doesn't fit.
+     */
+    template <typename Msg>
+    static char* write(char* p, char* end, const Msg& msg)
+    {
+        if (static_cast<size_t>(end - p) < size(msg))
+            return nullptr;
+        return write(p, msg);
+    }
+
+    /**
+     * @brief render() appends @a msg to @a out, growing it only once.
+     */
+    template <typename Msg>
+    static void render(string_t& out, const Msg& msg)
+    {
+        size_t at = out.size();
+        out.resize(at + size(msg));
+        char* end = write(&out[at], msg);
+        assert(end == &out[0] + out.size());
+        (void)end;
+    }
+
+    /**
+     * @brief render_unframed() appends the head of the response @a res
+     * like render(), but leaves a body of unknown length unframed, to be
+     * ended by closing the connection, as HTTP/1.0 clients need.
+     */
+    template <typename Res>
+    static void render_unframed(string_t& out, const Res& res)
+    {
+        counter c;
+        emit_response(c, res, false);
+        size_t at = out.size();
+        out.resize(at + c.n);
+        buffer b = { &out[at] };
+        emit_response(b, res, false);
+        assert(b.p == &out[0] + out.size());
+    }
+
+    /**
+     * @brief gather builds a gather list of up to @a max entries of
+     * type Vec, which is http::chunk or struct iovec.
+     */
+    template <typename Vec>
+    class gather {
+    public:
+        gather(Vec* vec, size_t max)
+            : vec_(vec)
+            , max_(max)
+            , count_(0)
+            , scratch_used_(0)
+        {
+        }
+
+        /**
+         * @brief add() appends the entries for @a msg and returns the
+         * total entry count, which is more than the maximum if they
+         * didn't all fit.
+         */
+        template <typename Msg>
+        size_t add(const Msg& msg)
+        {
+            emit(*this, msg);
+            return count_;
+        }
+
+        size_t count() const { return count_; }
+        bool overflow() const { return count_ > max_; }
+
+        void append(const char* p, size_t n)
+        {
+            if (!n)
+                return;
+            if (count_ > 0 && count_ <= max_ && chunk_end(vec_[count_ - 1]) == p) {
+                set_chunk(vec_[count_ - 1], chunk_data(vec_[count_ - 1]), chunk_size(vec_[count_ - 1]) + n);
+                return;
+            }
+            if (count_ < max_)
+                set_chunk(vec_[count_], p, n);
+            ++count_;
+        }
+
+        void append_uint64(uint64_t n)
+        {
+            assert(scratch_used_ + max_uint64_digits <= sizeof(scratch_));
+            char* p = scratch_ + scratch_used_;
+            char* end = put_uint64(p, n);
+            scratch_used_ += static_cast<size_t>(end - p);
+            append(p, static_cast<size_t>(end - p));
+        }
+
+    private:
+        Vec* vec_;
+        size_t max_;
+        size_t count_;
+        size_t scratch_used_;
+        char scratch_[max_uint64_digits * 2];
+
+        gather(const gather&);
+        gather& operator=(const gather&);
+    };
+
+    static size_t uint64_digits(uint64_t n)
+    {
+        size_t len = 1;
+        for (;;) {
+            if (n < 10)
+                return len;
+            if (n < 100)
+                return len + 1;
+            if (n < 1000)
+                return len + 2;
+            if (n < 10000)
+                return len + 3;
+            n /= 10000;
+            len += 4;
+        }
+    }
+
+    /**
+     * @brief put_uint64() writes @a n in decimal two digits at a time
+     * and returns the end of the output.
+     */
+    static char* put_uint64(char* p, uint64_t n)
+    {
+        static const char pairs[] = "00010203040506070809"
+                                    "10111213141516171819"
+                                    "20212223242526272829"
+                                    "30313233343536373839"
+                                    "40414243444546474849"
+                                    "50515253545556575859"
+                                    "60616263646566676869"
+                                    "70717273747576777879"
+                                    "80818283848586878889"
+                                    "90919293949596979899";
+        char* end = p + uint64_digits(n);
+        char* q = end;
+        while (n >= 100) {
+            unsigned i = static_cast<unsigned>(n % 100) * 2;
+            n /= 100;
+            *--q = pairs[i + 1];
+            *--q = pairs[i];
+        }
+        if (n >= 10) {
+            unsigned i = static_cast<unsigned>(n) * 2;
+            *--q = pairs[i + 1];
+            *--q = pairs[i];
+        } else {
+            *--q = static_cast<char>('0' + n);
+        }
+        assert(q == p);
+        return end;
+    }
+
+    /**
+     * @brief has_body() returns false for the status codes whose
+     * responses never have a body.
+     */
+    static bool has_body(uint16_t code) { return code >= 200 && code != 204 && code != 304; }
+
+    /**
+     * @brief put_chunk_size() writes the line starting a chunk of @a n
+     * bytes in the chunked transfer coding, which takes at most
+     * max_chunk_line bytes, and returns the end of the output.
+     */
+    static char* put_chunk_size(char* p, size_t n)
+    {
+        static const char hex[] = "0123456789abcdef";
+        int shift = 0;
+        while (shift < 60 && (n >> (shift + 4)))
+            shift += 4;
+        for (; shift >= 0; shift -= 4)
+            *p++ = hex[(n >> shift) & 0xf];
+        *p++ = '\r';
+        *p++ = '\n';
+        return p;
+    }
+
+    /**
+     * @brief status_line() returns the complete status line for common
+     * status codes, or nullptr.
+     */
+    static const char* status_line(uint16_t code)
+    {
+        switch (code) {
+        case 100: return "HTTP/1.1 100 Continue\r\n";
+        case 101: return "HTTP/1.1 101 Switching Protocols\r\n";
+        case 200: return "HTTP/1.1 200 OK\r\n";
+        case 201: return "HTTP/1.1 201 Created\r\n";
+        case 202: return "HTTP/1.1 202 Accepted\r\n";
+        case 204: return "HTTP/1.1 204 No Content\r\n";
+        case 206: return "HTTP/1.1 206 Partial Content\r\n";
+        case 301: return "HTTP/1.1 301 Moved Permanently\r\n";
+        case 302: return "HTTP/1.1 302 Found\r\n";
+        case 303: return "HTTP/1.1 303 See Other\r\n";
+        case 304: return "HTTP/1.1 304 Not Modified\r\n";
+        case 307: return "HTTP/1.1 307 Temporary Redirect\r\n";
+        case 308: return "HTTP/1.1 308 Permanent Redirect\r\n";
+        case 400: return "HTTP/1.1 400 Bad Request\r\n";
+        case 401: return "HTTP/1.1 401 Unauthorized\r\n";
+        case 403: return "HTTP/1.1 403 Forbidden\r\n";
+        case 404: return "HTTP/1.1 404 Not Found\r\n";
+        case 405: return "HTTP/1.1 405 Method Not Allowed\r\n";
+        case 408: return "HTTP/1.1 408 Request Timeout\r\n";
+        case 409: return "HTTP/1.1 409 Conflict\r\n";
+        case 410: return "HTTP/1.1 410 Gone\r\n";
+        case 411: return "HTTP/1.1 411 Length Required\r\n";
+        case 413: return "HTTP/1.1 413 Payload Too Large\r\n";
+        case 414: return "HTTP/1.1 414 URI Too Long\r\n";
+        case 415: return "HTTP/1.1 415 Unsupported Media Type\r\n";
+        case 416: return "HTTP/1.1 416 Range Not Satisfiable\r\n";
+        case 429: return "HTTP/1.1 429 Too Many Requests\r\n";
+        case 500: return "HTTP/1.1 500 Internal Server Error\r\n";
+        case 501: return "HTTP/1.1 501 Not Implemented\r\n";
+        case 502: return "HTTP/1.1 502 Bad Gateway\r\n";
+        case 503: return "HTTP/1.1 503 Service Unavailable\r\n";
+        case 504: return "HTTP/1.1 504 Gateway Timeout\r\n";
+        }
+        return nullptr;
+    }
+
+private:
+    struct counter {
+        size_t n;
+
+        counter()
+            : n(0)
+        {
+        }
+
+        void append(const char*, size_t len) { n += len; }
+        void append_uint64(uint64_t v) { n += uint64_digits(v); }
+    };
+
+    struct buffer {
+        char* p;
+
+        void append(const char* src, size_t len)
+        {
+            memcpy(p, src, len);
+            p += len;
+        }
+
+        void append_uint64(uint64_t v) { p = put_uint64(p, v); }
+    };
+
+    template <typename Out>
+    static void literal(Out& out, const char* c_str)
+    {
+        out.append(c_str, strlen(c_str));
+    }
+
+    // calls fn(name, value) for each non-empty value
+    template <typename Fn>
+    static void each_value(const kvv& kv, Fn& fn)
+    {
+        for (size_t i = 0; i < kv.size(); ++i) {
+            text key(kv.at(i));
+            if (key.is_null())
+                break;
+            while (++i < kv.size()) {
+                text val(kv.at(i));
+                if (val.is_null())
+                    break;
+                fn(key, val);
+            }
+        }
+    }
+
+    template <typename Out>
+    struct query_fn {
+        Out& out;
+        const char* prefix;
+
+        void operator()(const text& key, const text& val)
+        {
+            out.append(prefix, 1);
+            prefix = "&";
+            key.render(out);
+            if (!val.empty()) {
+                out.append("=", 1);
+                val.render(out);
+            }
+        }
+    };
+
+    template <typename Out>
+    struct header_fn {
+        Out& out;
+        unsigned skip_key;
+
+        void operator()(const text& key, const text& val)
+        {
+            if (val.empty() || (skip_key && key.key() == skip_key))
+                return;
+            key.render(out);
+            out.append(": ", 2);
+            val.render(out);
+            out.append("\r\n", 2);
+        }
+    };
+
+    template <typename Out>
+    static void emit_tail(Out& out, int64_t content_length)
+    {
+        if (content_length >= 0) {
+            out.append("Content-Length: ", 16);
+            out.append_uint64(static_cast<uint64_t>(content_length));
+            out.append("\r\n", 2);
+        }
+        out.append("\r\n", 2);
+    }
+
+    // requests and request views
+    template <typename Out, typename Req>
+    static void emit(Out& out, const Req& req, decltype(&Req::host) = 0)
+    {
+        if (req.method().is_null())
+            return;
+        req.method().render(out);
+        out.append(" ", 1);
+        req.route().render(out);
+        query_fn<Out> qfn = { out, "?" };
+        each_value(req.query(), qfn);
+        out.append(" HTTP/1.1\r\n", 11);
+        header_fn<Out> hfn = { out, 0 };
+        each_value(req.headers(), hfn);
+        text host(req.host());
+        if (!host.empty()) {
+            out.append("Host: ", 6);
+            host.render(out);
+            out.append("\r\n", 2);
+        }
+        emit_tail(out, req.content_length());
+    }
+
+    // responses
+    template <typename Out, typename Res>
+    static void emit(Out& out, const Res& res, decltype(&Res::code) = 0)
+    {
+        emit_response(out, res, res.content_length() < 0 && has_body(res.code()));
+    }
+
+    template <typename Out, typename Res>
+    static void emit_response(Out& out, const Res& res, bool chunked)
+    {
+        text status(res.status());
+        const char* line = status.empty() ? status_line(res.code()) : nullptr;
+        if (line != nullptr) {
+            literal(out, line);
+        } else {
+            out.append("HTTP/1.1 ", 9);
+            out.append_uint64(res.code());
+            out.append(" ", 1);
+            status.render(out);
+            out.append("\r\n", 2);
+        }
+        // the reason phrase travels as the Status header
+        static const unsigned status_key = symbol("Status");
+        header_fn<Out> hfn = { out, status_key };
+        each_value(res.headers(), hfn);
+        if (chunked)
+            out.append("Transfer-Encoding: chunked\r\n", 28);
+        emit_tail(out, res.content_length());
+    }
+
+    static void set_chunk(chunk& c, const char* p, size_t n)
+    {
+        c.data = p;
+        c.size = n;
+    }
+    static const char* chunk_data(const chunk& c) { return c.data; }
+    static size_t chunk_size(const chunk& c) { return c.size; }
+    static const char* chunk_end(const chunk& c) { return c.data + c.size; }
+
+#ifndef _WIN32
+    static void set_chunk(struct iovec& v, const char* p, size_t n)
+    {
+        v.iov_base = const_cast<char*>(p);
+        v.iov_len = n;
+    }
+    static const char* chunk_data(const struct iovec& v) { return static_cast<const char*>(v.iov_base); }
+    static size_t chunk_size(const struct iovec& v) { return v.iov_len; }
+    static const char* chunk_end(const struct iovec& v) { return chunk_data(v) + v.iov_len; }
+#endif
+};
+
+} // namespace rap
+
+#endif // RAP_HTTP_HPP
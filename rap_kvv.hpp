@@ -4,11 +4,13 @@
 #include "rap.hpp"
 #include "rap_frame.h"
 #include "rap_reader.hpp"
+#include "rap_smallvec.hpp"
 #include "rap_text.hpp"
 #include "rap_writer.hpp"
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <string>
 #include <vector>
 
@@ -16,6 +18,11 @@ namespace rap {
 
 class kvv {
 public:
+    enum {
+        inline_size = 24, /**< texts stored without allocating, 8 single valued names */
+        index_threshold = 8 /**< names needed before find() builds an index */
+    };
+
     kvv() {}
 
     kvv(const kvv& other)
@@ -39,22 +46,65 @@ public:
         }
     }
 
+    kvv& operator=(const kvv& other)
+    {
+        data_ = other.data_;
+        index_.clear();
+        return *this;
+    }
+
     size_t size() const { return data_.size(); }
     text at(size_t n) const { return data_.at(n); }
+    void set(size_t n, const text& t)
+    {
+        data_.at(n) = t;
+        index_.clear();
+    }
+
+    /**
+     * @brief find() returns the index of the first value of @a key,
+     * or zero if it isn't present.
+     */
     size_t find(const char* key) const
     {
-        size_t i = 0;
-        while (i < data_.size()) {
-            if (data_.at(i).is_null())
-                break;
-            if (data_.at(i) == key)
+        size_t len = strlen(key);
+        if (unsigned k = rap_textmap_to_key(key, len))
+            return find(k);
+        for (size_t i = 0; i < data_.size(); i = next(i)) {
+            const text& t = data_[i];
+            if (t.size() == len && !t.key() && !memcmp(t.data(), key, len))
                 return i + 1;
-            while (!data_.at(i).is_null())
-                ++i;
         }
         return 0;
     }
 
+    /**
+     * @brief find() returns the index of the first value of the
+     * name with the textmap key @a key, see rap::symbol(), whether
+     * it was sent as the key or spelled out.
+     */
+    size_t find(unsigned key) const
+    {
+        if (key < 2 || key >= num_keys)
+            return 0;
+        if (!index_.empty())
+            return index_[key];
+        size_t len = 0;
+        const char* word = rap_textmap_from_key(key, &len);
+        if (word == nullptr)
+            return 0;
+        size_t names = 0;
+        for (size_t i = 0; i < data_.size(); i = next(i)) {
+            const text& t = data_[i];
+            if (t.key() == key || (!t.key() && t.size() == len && !memcmp(t.data(), word, len)))
+                return i + 1;
+            ++names;
+        }
+        if (names >= index_threshold)
+            build_index();
+        return 0;
+    }
+
     const rap::writer& operator>>(const rap::writer& w) const
     {
         for (size_t i = 0; i < size(); ++i)
@@ -64,7 +114,36 @@ public:
     }
 
 protected:
-    std::vector<text> data_;
+    smallvec<text, inline_size> data_;
+
+private:
+    enum { num_keys = 0x80 };
+
+    // value index of the first name with each textmap key, built on a miss
+    mutable std::vector<uint32_t> index_;
+
+    // returns the index of the name following the one at i
+    size_t next(size_t i) const
+    {
+        while (++i < data_.size() && !data_[i].is_null()) {
+        }
+        return i + 1;
+    }
+
+    // names spelled out in full are indexed by the textmap key they match
+    void build_index() const
+    {
+        index_.assign(num_keys, 0);
+        for (size_t i = data_.size(); i-- > 0;) {
+            if (i == 0 || data_[i - 1].is_null()) {
+                const text& t = data_[i];
+                unsigned k = t.key() || t.empty() ? t.key() : rap_textmap_to_key(t.data(), t.size());
+                if (k < num_keys)
+                    index_[k] = static_cast<uint32_t>(i + 1);
+            }
+        }
+        index_[0] = 0;
+    }
 };
 
 class query : public kvv {
@@ -112,6 +191,23 @@ public:
         : kvv(r)
     {
     }
+
+    // header names are case insensitive, so they match the textmap in any case
+    const rap::writer& operator>>(const rap::writer& w) const
+    {
+        bool is_name = true;
+        for (size_t i = 0; i < size(); ++i) {
+            text t(at(i));
+            if (is_name)
+                w.write_header_name(t.data(), t.size());
+            else
+                w << t;
+            is_name = t.is_null();
+        }
+        w << text();
+        return w;
+    }
+
     void render(string_t& out) const
     {
         for (size_t i = 0; i < size(); ++i) {
@@ -141,6 +237,12 @@ inline const rap::writer& operator<<(const rap::writer& w,
     return kvv >> w;
 }
 
+inline const rap::writer& operator<<(const rap::writer& w,
+    const rap::headers& h)
+{
+    return h >> w;
+}
+
 } // namespace rap
 
 #endif // RAP_KVV_HPP
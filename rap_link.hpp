@@ -3,11 +3,17 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <vector>
 
 #include "rap.hpp"
 #include "rap_callbacks.h"
 #include "rap_frame.h"
+#include "rap_route.hpp"
+#include "rap_scheduler.hpp"
+#include "rap_stringtable.hpp"
 #include "rap_text.hpp"
+#include "rap_trace.hpp"
 
 namespace rap {
 
@@ -21,28 +27,225 @@ public:
     explicit link(void* muxer_user_data, rap_muxer_write_cb_t muxer_write_cb)
         : muxer_user_data_(muxer_user_data)
         , muxer_write_cb_(muxer_write_cb)
+        , muxer_writev_cb_(nullptr)
+        , scheduler_(nullptr)
+        , corked_(0)
+        , out_head_(nullptr)
+        , out_tail_(nullptr)
+        , out_size_(0)
+        , out_error_(0)
+        , credit_window_(0)
+        , credit_used_(0)
         , frame_ptr_(frame_buf_)
+#if RAP_TRACE
+        , tracer_(nullptr)
+        , trace_link_(0)
+#endif
     {
     }
 
-    virtual ~link() {}
+    virtual ~link()
+    {
+        discard_output();
+    }
+
+    /**
+     * @brief set_writev_cb() sets a callback that receives all output
+     * collected while the link is corked in a single call. If not set,
+     * the #muxer_write_cb callback is used instead.
+     */
+    void set_writev_cb(rap_muxer_writev_cb_t muxer_writev_cb)
+    {
+        muxer_writev_cb_ = muxer_writev_cb;
+    }
 
     /**
      * @brief write() calls the #muxer_write_cb callback function, 
      * writing @a src_len bytes from @a src_buf to the network.
      * 
+     * While the link is corked, the bytes are copied to the output
+     * staging area instead, and written when the link is uncorked.
+     * 
      * @param src_buf the bytes to write, must not be NULL
      * @param src_len the number of bytes to write
      * @return int return value from #muxer_write_cb
      */
-    int write(const char* src_buf, int src_len) const
+    int write(const char* src_buf, int src_len)
     {
+        trace(true, src_buf, static_cast<size_t>(src_len));
+        if (corked_)
+            return append_output(src_buf, src_len);
+        if (muxer_writev_cb_) {
+            rap_iovec iov;
+            iov.iov_base = src_buf;
+            iov.iov_len = static_cast<size_t>(src_len);
+            return muxer_writev_cb_(muxer_user_data(), &iov, 1);
+        }
         return muxer_write_cb_(muxer_user_data(), src_buf, src_len);
     }
 
+    /**
+     * @brief write() hands the two buffers to the network in a single
+     * callback invocation.
+     * 
+     * @return int return value from the write callback
+     */
+    int write(const char* a_buf, int a_len, const char* b_buf, int b_len)
+    {
+        trace(true, a_buf, static_cast<size_t>(a_len), b_buf, static_cast<size_t>(b_len));
+        if (corked_) {
+            if (int rv = append_output(a_buf, a_len))
+                return rv;
+            return append_output(b_buf, b_len);
+        }
+        if (muxer_writev_cb_) {
+            rap_iovec iov[2];
+            iov[0].iov_base = a_buf;
+            iov[0].iov_len = static_cast<size_t>(a_len);
+            iov[1].iov_base = b_buf;
+            iov[1].iov_len = static_cast<size_t>(b_len);
+            return muxer_writev_cb_(muxer_user_data(), iov, 2);
+        }
+        out_buf_.resize(static_cast<size_t>(a_len + b_len));
+        memcpy(out_buf_.data(), a_buf, static_cast<size_t>(a_len));
+        memcpy(out_buf_.data() + a_len, b_buf, static_cast<size_t>(b_len));
+        return muxer_write_cb_(muxer_user_data(), out_buf_.data(), a_len + b_len);
+    }
+
+    /**
+     * @brief write_ref() adds @a src_len bytes at @a src_buf to the
+     * output without copying them. Only allowed while corked, and the
+     * bytes must stay valid until release_output() is called for the
+     * connection @a id.
+     * 
+     * @return int return value from the write callback if the output
+     * had to be flushed
+     */
+    int write_ref(rap_conn_id id, const char* src_buf, size_t src_len)
+    {
+        return write_ref(id, src_buf, src_len, nullptr, 0);
+    }
+
+    /**
+     * @brief write_ref() adds a frame whose header and payload are in
+     * separate buffers, with the same rules as the above.
+     */
+    int write_ref(rap_conn_id id, const char* a_buf, size_t a_len, const char* b_buf, size_t b_len)
+    {
+        assert(corked_ > 0);
+        if (out_error_)
+            return out_error_;
+        trace(true, a_buf, a_len, b_buf, b_len);
+        add_ref(a_buf, a_len);
+        if (b_len)
+            add_ref(b_buf, b_len);
+        if (out_ids_.empty() || out_ids_.back() != id)
+            out_ids_.push_back(id);
+        if (out_size_ >= rap_max_cork_size)
+            return flush_output();
+        return 0;
+    }
+
+#if RAP_TRACE
+    /**
+     * @brief set_tracer() records the frames read and written from now
+     * on with @a t, tagged with @a link_id, or stops if @a t is nullptr.
+     */
+    void set_tracer(rap::tracer* t, uint32_t link_id)
+    {
+        tracer_ = t;
+        trace_link_ = link_id;
+    }
+#endif
+
+    /**
+     * @brief set_scheduler() replaces the output scheduler. The
+     * scheduler must outlive the link.
+     */
+    void set_scheduler(rap::scheduler* s) { scheduler_ = s; }
+    rap::scheduler* scheduler() const { return scheduler_; }
+
+    /**
+     * @brief cork() makes writes collect in the output staging area
+     * until a matching uncork(). Calls may be nested.
+     */
+    void cork() { ++corked_; }
+
+    /**
+     * @brief uncork() undoes one cork(), and once the last one is undone
+     * writes all collected output to the network in one go.
+     * 
+     * @return int return value from the write callback
+     */
+    int uncork()
+    {
+        assert(corked_ > 0);
+        if (corked_ == 1 && scheduler_)
+            scheduler_->run();
+        if (corked_ > 0 && --corked_ == 0)
+            return flush_output();
+        return 0;
+    }
+
+    bool corked() const { return corked_ > 0; }
+
+    /**
+     * @brief defer_ack() registers the connection @a id as having an
+     * ACK pending, to be sent once the current call to recv() is done.
+     */
+    void defer_ack(rap_conn_id id) { ack_ids_.push_back(id); }
+
+    /**
+     * @brief has_credit() checks if the link-level byte window the peer
+     * has granted allows sending another frame. Always true unless the
+     * peer has advertised a link window in its setup frame.
+     */
+    bool has_credit() const { return !credit_window_ || credit_used_ < credit_window_; }
+
+    /**
+     * @brief use_credit() accounts for @a n bytes sent to the peer. Sent
+     * bytes are counted even while there is no link window, since the
+     * peer returns credit for everything it processes.
+     */
+    void use_credit(size_t n) { credit_used_ += static_cast<int64_t>(n); }
+
+    /**
+     * @brief wait_credit() registers the connection @a id as waiting
+     * for the peer to grant more link credit.
+     */
+    void wait_credit(rap_conn_id id) { credit_ids_.push_back(id); }
+
+    /**
+     * @brief slabs() returns the pool of queue memory shared by the
+     * connections on this link.
+     */
+    slabpool& slabs() { return slabs_; }
+
+    /**
+     * @brief strings() returns the strings the peer has defined, for
+     * use with rap::reader.
+     */
+    const stringtable& strings() const { return recv_strings_; }
+
+    /**
+     * @brief send_strings() returns the strings defined for the peer,
+     * for use with rap::writer.
+     */
+    const stringtable& send_strings() const { return send_strings_; }
+
+    /**
+     * @brief routes() returns the route templates the peer has defined,
+     * for use with rap::reader.
+     */
+    const routetable& routes() const { return recv_routes_; }
+    const routetable& send_routes() const { return send_routes_; }
+
     /**
      * @brief consume up to @a src_len bytes of data from @a src_buf
      * 
+     * Complete frames are dispatched directly from @a src_buf. Only a frame
+     * that is split across calls is staged in the internal frame buffer.
+     * 
      * @param src_buf the bytes to read, must not be NULL
      * @param src_len number of bytes to read
      * @return int number of bytes consumed, or less if there is an error.
@@ -55,39 +258,41 @@ public:
         const char* src_ptr = src_buf;
         const char* src_end = src_ptr + src_len;
 
-        while (src_ptr < src_end) {
-            // make sure we have header
-            while (frame_ptr_ < frame_buf_ + rap_frame_header_size) {
-                if (src_ptr >= src_end)
-                    return static_cast<int>(src_ptr - src_buf);
-                assert(src_ptr < src_end);
-                *frame_ptr_++ = *src_ptr++;
-            }
+        cork();
 
-            // copy data until frame is complete
-            size_t frame_len = rap_frame::needed_bytes(frame_buf_);
-            assert(frame_len <= sizeof(frame_buf_));
-            const char* frame_end = frame_buf_ + frame_len;
-            assert(frame_end <= frame_buf_ + sizeof(frame_buf_));
-            while (src_ptr < src_end && frame_ptr_ < frame_end) {
-                *frame_ptr_++ = *src_ptr++;
-            }
-
-            if (frame_ptr_ < frame_end)
+        // complete the frame left over from the previous call, if any
+        if (frame_ptr_ > frame_buf_) {
+            src_ptr = stage(src_ptr, src_end);
+            if (!staged_frame_complete()) {
+                uncork();
                 return static_cast<int>(src_ptr - src_buf);
-
-            // frame completed
-            const rap_frame* f = reinterpret_cast<const rap_frame*>(frame_buf_);
-            uint16_t id = f->header().id();
-            if (id == rap_muxer_conn_id) {
-                process_muxer(f);
-            } else {
-                error ec = rap_err_ok;
-                process_frame(id, f, static_cast<int>(frame_ptr_ - frame_buf_), ec);
             }
+            dispatch(reinterpret_cast<const rap_frame*>(frame_buf_),
+                static_cast<int>(frame_ptr_ - frame_buf_));
             frame_ptr_ = frame_buf_;
         }
+
+        // dispatch complete frames in place
+        while (src_end - src_ptr >= rap_frame_header_size) {
+            size_t frame_len = rap_frame::needed_bytes(src_ptr);
+            assert(frame_len <= sizeof(frame_buf_));
+            if (frame_len > static_cast<size_t>(src_end - src_ptr))
+                break;
+            dispatch(reinterpret_cast<const rap_frame*>(src_ptr),
+                static_cast<int>(frame_len));
+            src_ptr += frame_len;
+        }
+
+        // stage the trailing partial frame
+        if (src_ptr < src_end) {
+            src_ptr = stage(src_ptr, src_end);
+            assert(!staged_frame_complete());
+        }
+
         assert(src_ptr == src_end);
+        flush_acks();
+        flush_credit();
+        uncork();
         return static_cast<int>(src_ptr - src_buf);
     }
 
@@ -95,12 +300,228 @@ protected:
     void* muxer_user_data() const { return muxer_user_data_; }
     virtual void process_muxer(const rap_frame* f) = 0;
     virtual bool process_frame(rap_conn_id id, const rap_frame* f, int len, rap::error& ec) = 0;
+    virtual void flush_ack(rap_conn_id id) = 0;
+    virtual void release_output(rap_conn_id id) = 0;
+    virtual void wake(rap_conn_id id) = 0;
+    virtual void flush_credit() = 0;
+
+    stringtable send_strings_;
+    stringtable recv_strings_;
+    routetable send_routes_;
+    routetable recv_routes_;
+
+    /**
+     * @brief set_credit() sets the link window the peer has advertised to
+     * @a n bytes, zero meaning no limit. Bytes sent that the peer hasn't
+     * returned yet stay counted against it, so a repeated setup frame
+     * doesn't let more than the window be in flight.
+     */
+    void set_credit(int64_t n)
+    {
+        assert(n >= 0);
+        credit_window_ = n;
+        if (has_credit())
+            wake_all();
+    }
+
+    /**
+     * @brief add_credit() returns @a n bytes the peer has processed,
+     * which can't be more than what was sent.
+     */
+    void add_credit(int64_t n)
+    {
+        credit_used_ -= n < credit_used_ ? n : credit_used_;
+        if (has_credit())
+            wake_all();
+    }
 
 private:
     void* muxer_user_data_;
     rap_muxer_write_cb_t muxer_write_cb_;
+    rap_muxer_writev_cb_t muxer_writev_cb_;
+    rap::scheduler* scheduler_;
+    int corked_;
+    frameslab* out_head_;
+    frameslab* out_tail_;
+    size_t out_size_;
+    int out_error_;
+    std::vector<rap_iovec> out_iov_;
+    std::vector<rap_conn_id> out_ids_;
+    int64_t credit_window_; // bytes the peer accepts in flight, or zero
+    int64_t credit_used_; // bytes sent that the peer hasn't returned
+    std::vector<rap_conn_id> credit_ids_;
+    slabpool slabs_;
+    std::vector<char> out_buf_;
+    std::vector<rap_conn_id> ack_ids_;
     char frame_buf_[rap_frame_max_size];
     char* frame_ptr_;
+#if RAP_TRACE
+    rap::tracer* tracer_;
+    uint32_t trace_link_;
+#endif
+
+    // records whole frames with the tracer, if one is set
+    void trace(bool send, const char* a_buf, size_t a_len,
+        const char* b_buf = nullptr, size_t b_len = 0)
+    {
+#if RAP_TRACE
+        if (tracer_)
+            tracer_->write(trace_link_, send ? tracer::dir_send : tracer::dir_recv,
+                a_buf, a_len, b_buf, b_len);
+#else
+        (void)send;
+        (void)a_buf;
+        (void)a_len;
+        (void)b_buf;
+        (void)b_len;
+#endif
+    }
+
+    void add_ref(const char* src_buf, size_t src_len)
+    {
+        rap_iovec iov;
+        iov.iov_base = src_buf;
+        iov.iov_len = src_len;
+        out_iov_.push_back(iov);
+        out_size_ += src_len;
+    }
+
+    void wake_all()
+    {
+        std::vector<rap_conn_id> ids;
+        ids.swap(credit_ids_);
+        for (size_t i = 0; i < ids.size(); ++i)
+            wake(ids[i]);
+    }
+
+    void flush_acks()
+    {
+        for (size_t i = 0; i < ack_ids_.size(); ++i)
+            flush_ack(ack_ids_[i]);
+        ack_ids_.clear();
+    }
+
+    // copies bytes to the output staging area, writing it out early
+    // if it grows beyond rap_max_cork_size
+    int append_output(const char* src_buf, int src_len)
+    {
+        if (out_error_)
+            return out_error_;
+        size_t n = static_cast<size_t>(src_len);
+        while (n > 0) {
+            if (out_tail_ == nullptr || out_tail_->room() == 0) {
+                frameslab* slab = slabs_.acquire(slabpool::large_slab_size);
+                if (slab == nullptr)
+                    return -1;
+                if (out_tail_ != nullptr)
+                    out_tail_->next = slab;
+                else
+                    out_head_ = slab;
+                out_tail_ = slab;
+            }
+            size_t chunk = n < out_tail_->room() ? n : out_tail_->room();
+            char* dst = out_tail_->data() + out_tail_->tail;
+            if (!out_iov_.empty() && static_cast<const char*>(out_iov_.back().iov_base) + out_iov_.back().iov_len == dst) {
+                out_iov_.back().iov_len += chunk;
+            } else {
+                rap_iovec iov;
+                iov.iov_base = dst;
+                iov.iov_len = chunk;
+                out_iov_.push_back(iov);
+            }
+            memcpy(dst, src_buf, chunk);
+            out_tail_->tail += chunk;
+            out_size_ += chunk;
+            src_buf += chunk;
+            n -= chunk;
+        }
+        if (out_size_ >= rap_max_cork_size)
+            return flush_output();
+        return 0;
+    }
+
+    // writes the output staging area to the network
+    int flush_output()
+    {
+        if (out_iov_.empty())
+            return out_error_;
+        int rv = out_error_;
+        if (!rv) {
+            if (muxer_writev_cb_) {
+                rv = muxer_writev_cb_(muxer_user_data(), out_iov_.data(), static_cast<int>(out_iov_.size()));
+            } else if (out_iov_.size() == 1) {
+                rv = muxer_write_cb_(muxer_user_data(), static_cast<const char*>(out_iov_[0].iov_base),
+                    static_cast<int>(out_iov_[0].iov_len));
+            } else {
+                out_buf_.resize(out_size_);
+                char* dst = out_buf_.data();
+                for (size_t i = 0; i < out_iov_.size(); ++i) {
+                    memcpy(dst, out_iov_[i].iov_base, out_iov_[i].iov_len);
+                    dst += out_iov_[i].iov_len;
+                }
+                rv = muxer_write_cb_(muxer_user_data(), out_buf_.data(), static_cast<int>(out_size_));
+            }
+            out_error_ = rv;
+        }
+        discard_output();
+        for (size_t i = 0; i < out_ids_.size(); ++i)
+            release_output(out_ids_[i]);
+        out_ids_.clear();
+        return rv;
+    }
+
+    void discard_output()
+    {
+        while (frameslab* slab = out_head_) {
+            out_head_ = slab->next;
+            slabs_.release(slab);
+        }
+        out_tail_ = nullptr;
+        out_size_ = 0;
+        out_iov_.clear();
+    }
+
+    void dispatch(const rap_frame* f, int len)
+    {
+        trace(false, f->data(), static_cast<size_t>(len));
+        uint16_t id = f->header().id();
+        if (id == rap_muxer_conn_id) {
+            process_muxer(f);
+        } else {
+            error ec = rap_err_ok;
+            process_frame(id, f, len, ec);
+        }
+    }
+
+    // number of bytes the staged frame needs in total, as far as is known
+    size_t staged_frame_len() const
+    {
+        if (frame_ptr_ < frame_buf_ + rap_frame_header_size)
+            return rap_frame_header_size;
+        return rap_frame::needed_bytes(frame_buf_);
+    }
+
+    bool staged_frame_complete() const
+    {
+        return frame_ptr_ >= frame_buf_ + rap_frame_header_size
+            && frame_ptr_ >= frame_buf_ + staged_frame_len();
+    }
+
+    // copies bytes into the frame buffer until the staged frame is
+    // complete or the source is exhausted, returns the new source pointer
+    const char* stage(const char* src_ptr, const char* src_end)
+    {
+        for (int pass = 0; pass < 2 && src_ptr < src_end; ++pass) {
+            size_t want = staged_frame_len() - static_cast<size_t>(frame_ptr_ - frame_buf_);
+            size_t have = static_cast<size_t>(src_end - src_ptr);
+            size_t n = want < have ? want : have;
+            assert(frame_ptr_ + n <= frame_buf_ + sizeof(frame_buf_));
+            memcpy(frame_ptr_, src_ptr, n);
+            frame_ptr_ += n;
+            src_ptr += n;
+        }
+        return src_ptr;
+    }
 };
 
 } // namespace rap
@@ -3,7 +3,7 @@
 
 #include <cassert>
 #include <cstdint>
-#include <vector>
+#include <memory>
 
 #include "rap.hpp"
 #include "rap_callbacks.h"
@@ -12,7 +12,11 @@
 #include "rap_text.hpp"
 
 #include "rap_conn.hpp"
+#include "rap_drr.hpp"
 #include "rap_link.hpp"
+#include "rap_reader.hpp"
+#include "rap_window.hpp"
+#include "rap_writer.hpp"
 
 namespace rap {
 
@@ -22,17 +26,13 @@ public:
         rap_muxer_write_cb_t muxer_write_cb,
         rap_muxer_conn_init_cb_t muxer_conn_init_cb)
         : link(muxer_user_data, muxer_write_cb)
-        , conns_(rap_max_conn_id + 1)
-    {
-        // assert correctly initialized conn vector
-        assert(conns_.size() == rap_max_conn_id + 1);
-        for (rap_conn_id id = 0; id < conns_.size(); ++id) {
-            conns_[id].init(
-                static_cast<rap_muxer*>(this), id, rap_max_send_window, nullptr, nullptr);
-            assert(conns_[id].id() == id);
-            if (muxer_conn_init_cb != nullptr)
-                muxer_conn_init_cb(this->muxer_user_data(), id, &conns_[id]);
-        }
+        , muxer_conn_init_cb_(muxer_conn_init_cb)
+        , peer_window_(rap_max_send_window)
+        , link_window_(rap_link_window)
+        , recv_pending_(0)
+        , setup_sent_(false)
+    {
+        set_scheduler(&drr_);
     }
 
     virtual ~muxer() {}
@@ -40,25 +40,327 @@ public:
     /**
      * @brief Get the connection object identified by it's ID
      * 
+     * Connections are created on first use, at which point the
+     * #muxer_conn_init_cb callback is invoked for them.
+     * 
      * @param id the id number of the connection
      * @return rap::conn* the connetion, or NULL if it was not found
      */
     rap::conn* get_conn(rap_conn_id id)
     {
-        if (id >= conns_.size())
+        if (id > rap_max_conn_id)
             return nullptr;
-        return &conns_[id];
+        std::unique_ptr<rap::conn[]>& page = pages_[id >> conn_page_bits];
+        if (!page)
+            page.reset(new rap::conn[conn_page_size]);
+        rap::conn* c = &page[id & conn_page_mask];
+        if (c->id() != id) {
+            c->init(static_cast<rap_muxer*>(this), id, conn_limits(), nullptr, nullptr);
+            assert(c->id() == id);
+            if (muxer_conn_init_cb_ != nullptr)
+                muxer_conn_init_cb_(this->muxer_user_data(), id, c);
+        }
+        return c;
+    }
+
+    /**
+     * @brief set_window_limits() sets the bounds for the adaptive send
+     * window of the connections. Takes effect for the upper bound on
+     * existing connections immediately, and fully for new connections.
+     * Call send_setup() afterwards to let the peer know.
+     */
+    void set_window_limits(const window_limits& limits)
+    {
+        limits_ = limits;
+        update_windows();
+    }
+
+    const window_limits& get_window_limits() const { return limits_; }
+
+    /**
+     * @brief set_link_window() sets how many bytes of frames the peer
+     * may have in flight towards us in total over all connections,
+     * zero meaning no limit. Takes effect when send_setup() is called.
+     */
+    void set_link_window(size_t n)
+    {
+        if (n != 0 && n < rap_frame_max_size)
+            n = rap_frame_max_size;
+        link_window_ = n;
+    }
+
+    size_t get_link_window() const { return link_window_; }
+
+    /**
+     * @brief send_setup() tells the peer how many frames per connection
+     * it may have in flight towards us, and how many bytes over all
+     * connections. A muxer answers the first setup frame it receives with
+     * one of its own, so only the side that wants to change the defaults
+     * needs to call this.
+     *
+     * @return int return value from #muxer_write_cb
+     */
+    int send_setup()
+    {
+        char buf[1 + 10 + 10];
+        char* p = buf;
+        *p++ = static_cast<char>(rap_frame_type_setup);
+        p = put_uint64(p, static_cast<uint64_t>(limits_.max_frames));
+        if (link_window_)
+            p = put_uint64(p, static_cast<uint64_t>(link_window_));
+        setup_sent_ = true;
+        return write_control(buf, p);
     }
 
+    /**
+     * @brief define_string() makes the peer learn @a src_ptr so that
+     * rap::writer can send it as a key byte from now on.
+     *
+     * When the table is full, the oldest definitions are evicted, but only
+     * while no connection has frames queued, since those may still refer
+     * to them. Frames encoded with a key must be written before defining
+     * another string.
+     *
+     * @return unsigned the key, or zero if the string can't be defined
+     */
+    unsigned define_string(const char* src_ptr, size_t src_len)
+    {
+        if (unsigned key = send_strings_.find(src_ptr, src_len))
+            return key;
+        unsigned key = send_strings_.add(src_ptr, src_len, false);
+        if (!key && idle())
+            key = send_strings_.add(src_ptr, src_len, true);
+        if (!key)
+            return 0;
+        char buf[rap_frame_header_size + 4];
+        rap_frame* f = reinterpret_cast<rap_frame*>(buf);
+        char* p = f->payload();
+        *p++ = static_cast<char>(rap_frame_type_set_string);
+        *p++ = static_cast<char>(key);
+        p = span_writer::put_length(p, src_len);
+        f->header() = rap_header(rap_muxer_conn_id);
+        f->header().set_head();
+        f->header().set_size_value(static_cast<size_t>(p - f->payload()) + src_len);
+        if (write(buf, static_cast<int>(p - buf), src_ptr, static_cast<int>(src_len)))
+            return 0;
+        return key;
+    }
+
+    /**
+     * @brief define_route() makes the peer learn the route template
+     * @a src_ptr, where each "{}" is a placeholder for a parameter, so
+     * that requests can refer to it by index with rap::writer::write_route().
+     *
+     * @return uint16_t the index, or zero if the table is full
+     */
+    uint16_t define_route(const char* src_ptr, size_t src_len)
+    {
+        if (uint16_t index = send_routes_.find(src_ptr, src_len))
+            return index;
+        uint16_t index = send_routes_.add(src_ptr, src_len);
+        if (!index)
+            return 0;
+        char buf[rap_frame_header_size + 5];
+        rap_frame* f = reinterpret_cast<rap_frame*>(buf);
+        char* p = f->payload();
+        *p++ = static_cast<char>(rap_frame_type_set_route);
+        p = span_writer::put_length(p, index);
+        p = span_writer::put_length(p, src_len);
+        f->header() = rap_header(rap_muxer_conn_id);
+        f->header().set_head();
+        f->header().set_size_value(static_cast<size_t>(p - f->payload()) + src_len);
+        if (write(buf, static_cast<int>(p - buf), src_ptr, static_cast<int>(src_len)))
+            return 0;
+        return index;
+    }
+
+    /**
+     * @brief set_string_budget() limits the bytes of strings defined
+     * for the peer.
+     */
+    void set_string_budget(size_t n) { send_strings_.set_budget(n); }
+
 private:
-    std::vector<rap::conn> conns_;
+    enum {
+        conn_page_bits = 6,
+        conn_page_size = 1 << conn_page_bits,
+        conn_page_mask = conn_page_size - 1,
+        conn_page_count = (rap_max_conn_id >> conn_page_bits) + 1
+    };
+
+    rap_muxer_conn_init_cb_t muxer_conn_init_cb_;
+    std::unique_ptr<rap::conn[]> pages_[conn_page_count];
+    drr_scheduler drr_;
+    window_limits limits_;
+    int peer_window_;
+    size_t link_window_;
+    size_t recv_pending_; // frame bytes processed, not yet returned as credit
+    bool setup_sent_;
+
+    static char* put_uint64(char* p, uint64_t n)
+    {
+        while (n >= 0x80) {
+            *p++ = static_cast<char>((n & 0x7f) | 0x80);
+            n >>= 7;
+        }
+        *p++ = static_cast<char>(n);
+        return p;
+    }
 
-    void process_muxer(const rap_frame* /*f*/) { assert(false); /* TODO */ }
+    int write_control(const char* src_ptr, const char* src_end)
+    {
+        char buf[rap_frame_header_size + 32];
+        size_t n = static_cast<size_t>(src_end - src_ptr);
+        assert(n <= sizeof(buf) - rap_frame_header_size);
+        rap_frame* f = reinterpret_cast<rap_frame*>(buf);
+        f->header() = rap_header(rap_muxer_conn_id);
+        f->header().set_head();
+        f->header().set_size_value(n);
+        memcpy(f->payload(), src_ptr, n);
+        return write(f->data(), static_cast<int>(f->size()));
+    }
+
+    // grants the peer more link credit once it has used up half
+    void flush_credit()
+    {
+        if (!setup_sent_ || !link_window_ || recv_pending_ < link_window_ / 2)
+            return;
+        char buf[1 + 10];
+        char* p = buf;
+        *p++ = static_cast<char>(rap_frame_type_credit);
+        p = put_uint64(p, static_cast<uint64_t>(recv_pending_));
+        recv_pending_ = 0;
+        write_control(buf, p);
+    }
+
+    void wake(rap_conn_id id)
+    {
+        if (rap::conn* c = get_conn(id))
+            c->wake();
+    }
+
+    // the link window to use for what the peer advertised, zero meaning
+    // no limit, and at least a frame so that sending can make progress
+    static int64_t credit_window(uint64_t n)
+    {
+        if (n > INT64_MAX)
+            return INT64_MAX;
+        if (n != 0 && n < rap_frame_max_size)
+            return rap_frame_max_size;
+        return static_cast<int64_t>(n);
+    }
+
+    // limits for a connection, given what the peer accepts
+    window_limits conn_limits() const
+    {
+        window_limits limits(limits_);
+        if (limits.max_frames > peer_window_)
+            limits.max_frames = peer_window_;
+        return limits;
+    }
+
+    bool idle()
+    {
+        for (size_t i = 0; i < conn_page_count; ++i) {
+            if (rap::conn* page = pages_[i].get()) {
+                for (size_t j = 0; j < conn_page_size; ++j)
+                    if (page[j].id() <= rap_max_conn_id && !page[j].idle())
+                        return false;
+            }
+        }
+        return true;
+    }
+
+    void update_windows()
+    {
+        int max_frames = conn_limits().max_frames;
+        for (size_t i = 0; i < conn_page_count; ++i) {
+            if (rap::conn* page = pages_[i].get()) {
+                for (size_t j = 0; j < conn_page_size; ++j)
+                    if (page[j].id() <= rap_max_conn_id)
+                        page[j].window().set_max(max_frames);
+            }
+        }
+    }
+
+    void process_muxer(const rap_frame* f)
+    {
+        if (!f->has_payload())
+            return;
+        rap::reader r(f);
+        switch (static_cast<unsigned char>(r.read_char())) {
+        case rap_frame_type_setup: {
+            uint64_t max_frames = r.read_uint64();
+            if (r.error())
+                return;
+            peer_window_ = max_frames > rap_max_send_window_limit
+                ? static_cast<int>(rap_max_send_window_limit)
+                : static_cast<int>(max_frames);
+            update_windows();
+            uint64_t peer_link_window = r.eof() ? 0 : r.read_uint64();
+            if (r.error())
+                peer_link_window = 0;
+            set_credit(credit_window(peer_link_window));
+            if (!setup_sent_)
+                send_setup();
+            break;
+        }
+        case rap_frame_type_credit: {
+            uint64_t n = r.read_uint64();
+            if (!r.error())
+                add_credit(n > INT64_MAX ? INT64_MAX : static_cast<int64_t>(n));
+            break;
+        }
+        case rap_frame_type_set_string: {
+            unsigned key = r.eof() ? 0 : r.read_uchar();
+            size_t len = r.read_length();
+            if (r.error() || key < stringtable::first_key || !len || len > r.size()) {
+#ifndef NDEBUG
+                fprintf(stderr, "rap::muxer::process_muxer(): bad string definition\n");
+#endif
+                break;
+            }
+            recv_strings_.set(key, r.data(), len);
+            break;
+        }
+        case rap_frame_type_set_route: {
+            size_t index = r.read_length();
+            size_t len = r.read_length();
+            if (r.error() || len > r.size()
+                || !recv_routes_.set(static_cast<uint16_t>(index), r.data(), len)) {
+#ifndef NDEBUG
+                fprintf(stderr, "rap::muxer::process_muxer(): bad route definition\n");
+#endif
+            }
+            break;
+        }
+        default:
+#ifndef NDEBUG
+            fprintf(stderr, "rap::muxer::process_muxer(): unknown frame type %02x\n",
+                static_cast<unsigned char>(*f->payload()));
+#endif
+            break;
+        }
+    }
+
+    void flush_ack(rap_conn_id id)
+    {
+        if (rap::conn* c = get_conn(id))
+            c->flush_ack();
+    }
+
+    void release_output(rap_conn_id id)
+    {
+        if (rap::conn* c = get_conn(id))
+            c->release_output();
+    }
 
     bool process_frame(rap_conn_id id, const rap_frame* f, int len, rap::error& ec)
     {
-        if (id < conns_.size()) {
-            return conns_[id].process_frame(f, len, ec);
+        if (rap::conn* c = get_conn(id)) {
+            if (!f->header().is_flow())
+                recv_pending_ += f->size();
+            return c->process_frame(f, len, ec);
         } else {
             ec = rap_err_invalid_conn_id;
 #ifndef NDEBUG
@@ -5,17 +5,30 @@
 #include "rap_frame.h"
 #include "rap_record.hpp"
 #include "rap_route.hpp"
+#include "rap_stringtable.hpp"
 #include "rap_text.hpp"
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 namespace rap {
 
 class reader {
 public:
-    reader(const rap_frame* f)
+    /**
+     * @brief reader decodes the payload of @a f, resolving dynamic string
+     * keys using @a strings and route indices using @a routes, normally
+     * rap::conn::strings() and rap::conn::routes().
+     */
+    reader(const rap_frame* f, const stringtable* strings = nullptr, const routetable* routes = nullptr)
         : frame_(f)
+        , strings_(strings)
+        , routes_(routes)
         , src_ptr_(f->payload())
         , src_end_(f->payload() + f->payload_size())
         , error_(rap_err_ok)
@@ -39,21 +52,43 @@ public:
     uint64_t read_uint64()
     {
         if (!error_) {
-            uint64_t accum = 0;
-            unsigned char s = 0;
-            while (src_ptr_ < src_end_) {
-                unsigned char uch = read_uchar();
-                if (uch < 0x80) {
-                    return accum | uint64_t(uch) << s;
+            if (src_ptr_ < src_end_ && static_cast<unsigned char>(*src_ptr_) < 0x80)
+                return static_cast<unsigned char>(*src_ptr_++);
+            if (src_end_ - src_ptr_ >= 8) {
+                uint64_t n;
+                if (size_t len = decode_uint64(src_ptr_, n)) {
+                    src_ptr_ += len;
+                    return n;
                 }
-                accum |= uint64_t(uch & 0x7f) << s;
-                s += 7;
             }
-            set_error(rap_err_incomplete_number);
+            return read_uint64_slow();
         }
         return 0;
     }
 
+    /**
+     * @brief read_uint64() decodes up to @a count varints into @a dst.
+     *
+     * @return size_t the number decoded, less than @a count on error
+     */
+    size_t read_uint64(uint64_t* dst, size_t count)
+    {
+        size_t i = 0;
+        while (!error_ && i < count && src_end_ - src_ptr_ >= 8) {
+            size_t len = decode_uint64(src_ptr_, dst[i]);
+            if (!len)
+                break;
+            src_ptr_ += len;
+            ++i;
+        }
+        for (; i < count; ++i) {
+            dst[i] = read_uint64();
+            if (error_)
+                break;
+        }
+        return i;
+    }
+
     int64_t read_int64()
     {
         uint64_t ux = read_uint64();
@@ -66,18 +101,39 @@ public:
     size_t read_length()
     {
         if (!error_) {
-            if (src_ptr_ + 1 <= src_end_) {
-                size_t length = static_cast<size_t>(read_uchar());
-                if (length < 0x80)
+            if (src_end_ - src_ptr_ >= 2) {
+                size_t length = static_cast<unsigned char>(src_ptr_[0]);
+                if (length < 0x80) {
+                    ++src_ptr_;
                     return length;
-                if (src_ptr_ + 1 <= src_end_)
-                    return ((length & 0x7f) << 8) | static_cast<size_t>(read_uchar());
+                }
+                length = ((length & 0x7f) << 8) | static_cast<unsigned char>(src_ptr_[1]);
+                src_ptr_ += 2;
+                return length;
             }
+            if (src_ptr_ < src_end_ && static_cast<unsigned char>(*src_ptr_) < 0x80)
+                return static_cast<unsigned char>(*src_ptr_++);
             set_error(rap_err_incomplete_length);
         }
         return 0;
     }
 
+    /**
+     * @brief read_length() decodes up to @a count lengths into @a dst.
+     *
+     * @return size_t the number decoded, less than @a count on error
+     */
+    size_t read_length(size_t* dst, size_t count)
+    {
+        size_t i = 0;
+        for (; i < count; ++i) {
+            dst[i] = read_length();
+            if (error_)
+                break;
+        }
+        return i;
+    }
+
     text read_text()
     {
         if (!error_) {
@@ -89,7 +145,7 @@ public:
                 }
                 set_error(rap_err_incomplete_string);
             } else if (!error_) {
-                return text(read_uchar());
+                return read_text_key();
             }
         }
         return text();
@@ -114,9 +170,8 @@ public:
     route read_route()
     {
         if (!error_) {
-            if (size_t length = read_length()) {
-				// TODO: routes
-                return route();
+            if (size_t index = read_length()) {
+                return read_indexed_route(static_cast<uint16_t>(index));
             } else if (!error_) {
                 return route(read_text());
             }
@@ -124,6 +179,45 @@ public:
         return route();
     }
 
+    /**
+     * @brief skip_text() steps over a text without resolving it.
+     *
+     * @return int the key byte if it was sent as a key, so zero for a
+     * null text, or -1 if it was sent in full or on error
+     */
+    int skip_text()
+    {
+        if (!error_) {
+            if (size_t length = read_length()) {
+                if (src_ptr_ + length <= src_end_) {
+                    src_ptr_ += length;
+                    return -1;
+                }
+                set_error(rap_err_incomplete_string);
+            } else if (!error_) {
+                if (src_ptr_ < src_end_)
+                    return read_uchar();
+                set_error(rap_err_incomplete_lookup);
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * @brief span() returns a reader for the bytes [@a begin, @a end) of
+     * the same frame, using the same tables.
+     */
+    reader span(const char* begin, const char* end) const
+    {
+        assert(begin <= end);
+        assert(begin >= frame_->payload() && end <= frame_->payload() + frame_->payload_size());
+        reader r(*this);
+        r.src_ptr_ = begin;
+        r.src_end_ = end;
+        r.error_ = rap_err_ok;
+        return r;
+    }
+
     void consume(size_t n)
     {
         assert(src_ptr_ + n <= src_end_);
@@ -141,10 +235,128 @@ public:
 
 private:
     const rap_frame* frame_;
+    const stringtable* strings_;
+    const routetable* routes_;
     const char* src_ptr_;
     const char* src_end_;
     rap::error error_;
 
+    text read_text_key()
+    {
+        if (src_ptr_ >= src_end_) {
+            set_error(rap_err_incomplete_lookup);
+            return text();
+        }
+        unsigned char key = read_uchar();
+        text txt;
+        if (key < stringtable::first_key) {
+            txt = text(key);
+            if (key > 0 && txt.is_null())
+                set_error(rap_err_string_index_unknown);
+            return txt;
+        }
+        if (strings_)
+            txt = strings_->get(key);
+        if (txt.is_null())
+            set_error(rap_err_string_index_unknown);
+        return txt;
+    }
+
+    route read_indexed_route(uint16_t index)
+    {
+        text tmpl;
+        if (routes_)
+            tmpl = routes_->get(index);
+        if (tmpl.is_null()) {
+            set_error(rap_err_string_index_unknown);
+            return route();
+        }
+        size_t count = route::count_holes(tmpl.data(), tmpl.size());
+        const char* params = src_ptr_;
+        for (size_t i = 0; i < count; ++i) {
+            size_t len = read_length();
+            if (error_)
+                return route();
+            if (src_ptr_ + len > src_end_) {
+                set_error(rap_err_incomplete_string);
+                return route();
+            }
+            src_ptr_ += len;
+        }
+        return route(index, tmpl, params, static_cast<size_t>(src_ptr_ - params), count);
+    }
+
+    uint64_t read_uint64_slow()
+    {
+        uint64_t accum = 0;
+        unsigned s = 0;
+        while (src_ptr_ < src_end_ && s < 64) {
+            unsigned char uch = read_uchar();
+            if (uch < 0x80)
+                return accum | uint64_t(uch) << s;
+            accum |= uint64_t(uch & 0x7f) << s;
+            s += 7;
+        }
+        set_error(rap_err_incomplete_number);
+        return 0;
+    }
+
+    static uint64_t load_le64(const char* p)
+    {
+        uint64_t x;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ \
+    || defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64)
+        memcpy(&x, p, sizeof(x));
+#else
+        x = 0;
+        for (int i = 7; i >= 0; --i)
+            x = (x << 8) | static_cast<unsigned char>(p[i]);
+#endif
+        return x;
+    }
+
+    static unsigned ctz64(uint64_t x)
+    {
+        assert(x != 0);
+#if defined(__GNUC__)
+        return static_cast<unsigned>(__builtin_ctzll(x));
+#elif defined(_MSC_VER) && defined(_M_X64)
+        unsigned long i;
+        _BitScanForward64(&i, x);
+        return static_cast<unsigned>(i);
+#else
+        unsigned n = 0;
+        while (!(x & 1)) {
+            x >>= 1;
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+    // decodes a varint of up to 8 bytes from 8 readable bytes at p without
+    // branching per byte, returning its length or zero if it is longer
+    static size_t decode_uint64(const char* p, uint64_t& n)
+    {
+        uint64_t x = load_le64(p);
+        uint64_t stops = ~x & 0x8080808080808080ull;
+        if (!stops)
+            return 0;
+        unsigned bits = ctz64(stops) + 1;
+        if (bits < 64)
+            x &= (uint64_t(1) << bits) - 1;
+        x &= 0x7f7f7f7f7f7f7f7full;
+        n = (x & 0x000000000000007full)
+            | ((x & 0x0000000000007f00ull) >> 1)
+            | ((x & 0x00000000007f0000ull) >> 2)
+            | ((x & 0x000000007f000000ull) >> 3)
+            | ((x & 0x0000007f00000000ull) >> 4)
+            | ((x & 0x00007f0000000000ull) >> 5)
+            | ((x & 0x007f000000000000ull) >> 6)
+            | ((x & 0x7f00000000000000ull) >> 7);
+        return bits / 8;
+    }
+
     void set_error(rap::error e)
     {
 #ifndef NDEBUG
@@ -2,6 +2,7 @@
 #define RAP_REQUEST_HPP
 
 #include "rap.hpp"
+#include "rap_http.hpp"
 #include "rap_kvv.hpp"
 #include "rap_reader.hpp"
 #include "rap_record.hpp"
@@ -38,33 +39,10 @@ public:
     text host() const { return host_; }
     int64_t content_length() const { return content_length_; }
 
-    void render(string_t& out) const
-    {
-        if (method().is_null())
-            return;
-        assert(!route().is_null());
-        assert(content_length() >= -1);
-        method().render(out);
-        out += ' ';
-        route().render(out);
-        query().render(out);
-        out += '\n';
-        headers().render(out);
-        if (!host().empty()) {
-            out += "Host: ";
-            host().render(out);
-            out += '\n';
-        }
-        if (content_length() >= 0) {
-            char buf[64];
-            int n = sprintf(buf, "%lld", static_cast<long long>(content_length()));
-            if (n > 0) {
-                out += "Content-Length: ";
-                out.append(buf, static_cast<size_t>(n));
-                out += '\n';
-            }
-        }
-    }
+    /**
+     * @brief render() appends the HTTP/1.1 message head to @a out.
+     */
+    void render(string_t& out) const { http::render(out, *this); }
 
 private:
     text method_;
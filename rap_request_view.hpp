@@ -0,0 +1,132 @@
+#ifndef RAP_REQUEST_VIEW_HPP
+#define RAP_REQUEST_VIEW_HPP
+
+#include "rap.hpp"
+#include "rap_http.hpp"
+#include "rap_kvv.hpp"
+#include "rap_reader.hpp"
+#include "rap_record.hpp"
+#include "rap_text.hpp"
+#include "rap_writer.hpp"
+
+#include <cassert>
+
+namespace rap {
+
+/**
+ * @brief request_view is a lazily decoded rap::request.
+ *
+ * The constructor decodes the method, scheme, route and content length,
+ * and only steps over the query, headers and host, noting where they
+ * are. Those are decoded each time they are asked for.
+ *
+ * Like the frame it reads from, a request_view is only valid during the
+ * callback that received the frame.
+ */
+class request_view : public record {
+public:
+    request_view(reader& r)
+        : record(r.frame())
+        , src_(r)
+        , content_length_(-1)
+        , portable_headers_(true)
+    {
+        method_ = r.read_text();
+        scheme_ = r.read_text();
+        route_ = r.read_route();
+        query_ = r.data();
+        skip_kvv(r);
+        headers_ = r.data();
+        portable_headers_ = skip_kvv(r);
+        host_ = r.data();
+        r.skip_text();
+        host_end_ = r.data();
+        content_length_ = r.read_int64();
+        assert(r.error() || content_length_ >= -1);
+    }
+
+    text method() const { return method_; }
+    text scheme() const { return scheme_; }
+    rap::route route() const { return route_; }
+    int64_t content_length() const { return content_length_; }
+
+    rap::query query() const
+    {
+        reader r(src_.span(query_, headers_));
+        return rap::query(r);
+    }
+
+    rap::headers headers() const
+    {
+        reader r(src_.span(headers_, host_));
+        return rap::headers(r);
+    }
+
+    text host() const { return src_.span(host_, host_end_).read_text(); }
+
+    /**
+     * @brief header_block() returns the headers exactly as they were
+     * encoded, including the terminating null text.
+     */
+    text header_block() const { return text(headers_, static_cast<size_t>(host_ - headers_)); }
+
+    /**
+     * @brief header_block_portable() returns true if the header block
+     * doesn't use dynamic string keys, so that it means the same thing
+     * on any link.
+     */
+    bool header_block_portable() const { return portable_headers_; }
+
+    /**
+     * @brief write_headers() writes the headers to @a w, copying the
+     * encoded block as-is when possible.
+     */
+    const rap::writer& write_headers(const rap::writer& w) const
+    {
+        if (portable_headers_)
+            w.write(headers_, static_cast<size_t>(host_ - headers_));
+        else
+            w << headers();
+        return w;
+    }
+
+    /**
+     * @brief render() appends the HTTP/1.1 message head to @a out.
+     */
+    void render(string_t& out) const { http::render(out, *this); }
+
+private:
+    reader src_;
+    text method_;
+    text scheme_;
+    rap::route route_;
+    const char* query_;
+    const char* headers_;
+    const char* host_;
+    const char* host_end_;
+    int64_t content_length_;
+    bool portable_headers_;
+
+    // steps over a kvv, returning false if it uses dynamic string keys
+    static bool skip_kvv(reader& r)
+    {
+        bool portable = true;
+        for (;;) {
+            int key = r.skip_text();
+            if (key == 0 || r.error())
+                break;
+            portable = portable && key < stringtable::first_key;
+            for (;;) {
+                int val = r.skip_text();
+                if (val == 0 || r.error())
+                    break;
+                portable = portable && val < stringtable::first_key;
+            }
+        }
+        return portable;
+    }
+};
+
+} // namespace rap
+
+#endif // RAP_REQUEST_VIEW_HPP
@@ -4,6 +4,7 @@
 #include <ostream>
 
 #include "rap.hpp"
+#include "rap_http.hpp"
 #include "rap_kvv.hpp"
 #include "rap_reader.hpp"
 #include "rap_record.hpp"
@@ -18,7 +19,7 @@ public:
         : record(r.frame())
         , code_(static_cast<uint16_t>(r.read_length()))
         , headers_(r)
-        , content_length_(-1)
+        , content_length_(r.read_int64())
     {
     }
 
@@ -29,42 +30,26 @@ public:
     {
     }
 
-    void render(string_t& out) const
-    {
-        char buf[64];
-        int n = sprintf(buf, "%03d", code());
-        if (n > 0)
-            out.append(buf, static_cast<size_t>(n));
-        out += ' ';
-        status().render(out);
-        out += '\n';
-        headers().render(out);
-        if (content_length() >= 0) {
-            n = sprintf(buf, "%lld", static_cast<long long>(content_length()));
-            if (n > 0) {
-                out += "Content-Length: ";
-                out.append(buf, static_cast<size_t>(n));
-                out += '\n';
-            }
-        }
-        return;
-    }
+    /**
+     * @brief render() appends the HTTP/1.1 message head to @a out.
+     */
+    void render(string_t& out) const { http::render(out, *this); }
 
     uint16_t code() const { return code_; }
     void set_code(uint16_t code) { code_ = code; }
     const rap::headers& headers() const { return headers_; }
     text status() const
     {
-        size_t i = headers_.find("Status");
+        size_t i = headers_.find(status_key());
         if (i == 0)
             return text();
         return headers_.at(i);
     }
     void set_status(text txt)
     {
-        size_t i = headers_.find("Status");
+        size_t i = headers_.find(status_key());
         if (i != 0)
-            headers_.at(i) = txt;
+            headers_.set(i, txt);
     }
     int64_t content_length() const { return content_length_; }
     void set_content_length(int64_t n) { content_length_ = n; }
@@ -78,6 +63,13 @@ public:
 
 private:
     uint16_t code_;
+
+    static unsigned status_key()
+    {
+        static const unsigned key = symbol("Status");
+        return key;
+    }
+
     rap::headers headers_;
     int64_t content_length_;
 };
@@ -1,32 +1,68 @@
 #ifndef RAP_ROUTE_HPP
 #define RAP_ROUTE_HPP
 
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "rap.hpp"
+#include "rap_constants.h"
 #include "rap_text.hpp"
 
 namespace rap {
 
+/**
+ * @brief route is the path of a request, either as literal text, or as
+ * the index of a template from the link's rap::routetable along with
+ * the parameters that fill in its "{}" placeholders.
+ */
 class route {
 public:
     route()
         : index_(0)
+        , params_(nullptr)
+        , params_len_(0)
+        , param_count_(0)
     {
     }
 
     route(const route& other)
         : text_(other.text_)
         , index_(other.index_)
+        , params_(other.params_)
+        , params_len_(other.params_len_)
+        , param_count_(other.param_count_)
     {
     }
 
     explicit route(const text& txt)
         : text_(txt)
         , index_(0)
+        , params_(nullptr)
+        , params_len_(0)
+        , param_count_(0)
     {
     }
 
     explicit route(uint16_t map_index)
         : index_(map_index)
+        , params_(nullptr)
+        , params_len_(0)
+        , param_count_(0)
+    {
+    }
+
+    /**
+     * @brief route creates an indexed route from its template @a tmpl and
+     * @a param_count parameters encoded as lengths and bytes at @a params.
+     */
+    route(uint16_t map_index, const text& tmpl, const char* params, size_t params_len, size_t param_count)
+        : text_(tmpl)
+        , index_(map_index)
+        , params_(params)
+        , params_len_(params_len)
+        , param_count_(param_count)
     {
     }
 
@@ -34,15 +70,31 @@ public:
     {
         index_ = other.index_;
         text_ = other.text_;
+        params_ = other.params_;
+        params_len_ = other.params_len_;
+        param_count_ = other.param_count_;
         return *this;
     }
 
-    void render(string_t& out) const
+    // Out is a string_t or anything else with append(const char*, size_t)
+    template <typename Out>
+    void render(Out& out) const
     {
-        if (index_ == 0)
+        if (index_ == 0) {
             text_.render(out);
-        else
-            ; // TODO
+            return;
+        }
+        const char* p = text_.data();
+        const char* end = p + text_.size();
+        size_t n = 0;
+        while (p < end) {
+            const char* hole = find_hole(p, end);
+            out.append(p, static_cast<size_t>(hole - p));
+            if (hole == end)
+                break;
+            param(n++).render(out);
+            p = hole + 2;
+        }
     }
 
     string_t str() const
@@ -55,9 +107,133 @@ public:
     bool is_null() const { return index_ == 0 && text_.is_null(); }
     bool empty() const { return index_ == 0 && text_.empty(); }
 
+    /**
+     * @brief index() returns the route table index, or zero for a literal
+     * route. Handlers can dispatch on it without comparing paths.
+     */
+    uint16_t index() const { return index_; }
+
+    /**
+     * @brief path() returns the literal path or the route template.
+     */
+    rap::text path() const { return text_; }
+
+    size_t param_count() const { return param_count_; }
+
+    rap::text param(size_t n) const
+    {
+        const char* p = params_;
+        for (size_t i = 0; i < param_count_; ++i) {
+            size_t len = read_length(p);
+            if (i == n)
+                return rap::text(p, len);
+            p += len;
+        }
+        return rap::text();
+    }
+
+    /**
+     * @brief count_holes() returns the number of "{}" placeholders in a
+     * route template.
+     */
+    static size_t count_holes(const char* p, size_t n)
+    {
+        const char* end = p + n;
+        size_t count = 0;
+        while ((p = find_hole(p, end)) != end) {
+            ++count;
+            p += 2;
+        }
+        return count;
+    }
+
 private:
-    text text_;
+    rap::text text_;
     uint16_t index_;
+    const char* params_;
+    size_t params_len_;
+    size_t param_count_;
+
+    static const char* find_hole(const char* p, const char* end)
+    {
+        while (p + 1 < end) {
+            if (p[0] == '{' && p[1] == '}')
+                return p;
+            ++p;
+        }
+        return end;
+    }
+
+    static size_t read_length(const char*& p)
+    {
+        size_t len = static_cast<unsigned char>(*p++);
+        if (len >= 0x80)
+            len = ((len & 0x7f) << 8) | static_cast<unsigned char>(*p++);
+        return len;
+    }
+};
+
+/**
+ * @brief routetable holds the route templates one side of a link has
+ * defined for the other. Indices start at one and are never reused, so
+ * a frame can't be decoded with the wrong template no matter how the
+ * output is scheduled.
+ */
+class routetable {
+public:
+    size_t size() const { return templates_.size(); }
+
+    /**
+     * @brief get() returns the template for @a index, or a null text.
+     */
+    text get(uint16_t index) const
+    {
+        if (index == 0 || index > templates_.size() || templates_[index - 1].empty())
+            return text();
+        const std::string& s = templates_[index - 1];
+        return text(s.data(), s.size());
+    }
+
+    /**
+     * @brief set() stores a definition received from the peer.
+     */
+    bool set(uint16_t index, const char* src_ptr, size_t src_len)
+    {
+        if (index == 0 || index > rap_max_routes || !src_len)
+            return false;
+        if (index > templates_.size())
+            templates_.resize(index);
+        templates_[index - 1].assign(src_ptr, src_len);
+        return true;
+    }
+
+    /**
+     * @brief find() returns the index of a template defined with add(),
+     * or zero.
+     */
+    uint16_t find(const char* src_ptr, size_t src_len) const
+    {
+        std::unordered_map<std::string, uint16_t>::const_iterator it = index_.find(std::string(src_ptr, src_len));
+        return it == index_.end() ? 0 : it->second;
+    }
+
+    /**
+     * @brief add() defines a new template and returns its index, or zero
+     * if the table is full.
+     */
+    uint16_t add(const char* src_ptr, size_t src_len)
+    {
+        if (!src_len || src_len >= 0x8000 || templates_.size() >= rap_max_routes)
+            return 0;
+        templates_.push_back(std::string(src_ptr, src_len));
+        uint16_t index = static_cast<uint16_t>(templates_.size());
+        index_[templates_.back()] = index;
+        return index;
+    }
+
+private:
+    std::vector<std::string> templates_;
+    std::unordered_map<std::string, uint16_t> index_;
 };
 
 } // namespace rap
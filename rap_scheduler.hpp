@@ -0,0 +1,52 @@
+#ifndef RAP_SCHEDULER_HPP
+#define RAP_SCHEDULER_HPP
+
+#include <cassert>
+#include <cstdint>
+
+#include "rap.hpp"
+#include "rap_constants.h"
+#include "rap_frame.h"
+
+namespace rap {
+
+/**
+ * @brief scheduler decides in which order the queued frames of the
+ * connections sharing a link are written.
+ *
+ * A connection calls ready() when it has queued frames that may be
+ * sendable. When the link is about to flush its output, it calls run(),
+ * which should keep calling rap::conn::send_next() on the ready
+ * connections until none of them can send any more.
+ */
+class scheduler {
+public:
+    virtual ~scheduler() {}
+    virtual void ready(rap::conn* c) = 0;
+    virtual void run() = 0;
+};
+
+/**
+ * @brief sched_state is the per-connection bookkeeping of the
+ * built-in #drr_scheduler.
+ */
+struct sched_state {
+    sched_state()
+        : next(nullptr)
+        , deficit(0)
+        , weight(1)
+        , priority(0)
+        , queued(false)
+    {
+    }
+
+    rap::conn* next;
+    size_t deficit;
+    int weight;
+    int priority;
+    bool queued;
+};
+
+} // namespace rap
+
+#endif // RAP_SCHEDULER_HPP
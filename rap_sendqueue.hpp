@@ -0,0 +1,206 @@
+#ifndef RAP_SENDQUEUE_HPP
+#define RAP_SENDQUEUE_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <new>
+
+#include "rap.hpp"
+#include "rap_callbacks.h"
+#include "rap_framepool.hpp"
+
+namespace rap {
+
+/**
+ * @brief sendqueue holds output waiting for the network as a chain of
+ * pooled buffers.
+ *
+ * Any number of threads may push() at the same time without locking,
+ * while a single consumer, normally the thread that owns the socket,
+ * takes buffers off with pop() and hands them back with recycle() once
+ * they have been written. The buffers live in framepool frames, so they
+ * are recycled through the calling thread's cache.
+ *
+ * This is Dmitry Vyukov's intrusive multi-producer single-consumer
+ * queue: a push is one atomic exchange, and a push that is half done
+ * only delays pop() until it completes.
+ */
+class sendqueue {
+public:
+    struct buffer {
+        std::atomic<buffer*> next;
+        size_t size;
+
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+        const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+    };
+
+    enum {
+        // puts the buffer past the frame header at an aligned address
+        frame_pad = (alignof(buffer) - rap_frame_header_size % alignof(buffer)) % alignof(buffer),
+        max_buffer_size = rap_frame_max_payload_size - frame_pad - sizeof(buffer)
+    };
+
+    sendqueue()
+        : head_(&stub_)
+        , tail_(&stub_)
+    {
+        stub_.next.store(nullptr, std::memory_order_relaxed);
+        stub_.size = 0;
+    }
+
+    ~sendqueue()
+    {
+        while (buffer* b = pop())
+            recycle(b);
+    }
+
+    /**
+     * @brief push() copies the @a iovcnt buffers at @a iov, less the
+     * first @a skip bytes, into pooled buffers and queues them.
+     *
+     * @return rap_err_ok, or rap_err_output_buffer_too_small if no
+     * buffer could be had, in which case nothing is queued
+     */
+    error push(const rap_iovec* iov, int iovcnt, size_t skip = 0)
+    {
+        size_t left = 0;
+        for (int i = 0; i < iovcnt; ++i)
+            left += iov[i].iov_len;
+        assert(skip <= left);
+        left -= skip;
+        buffer* first = nullptr;
+        buffer* last = nullptr;
+        const char* src = nullptr;
+        size_t src_len = 0;
+        while (left > 0) {
+            buffer* b = create(left < max_buffer_size ? left : static_cast<size_t>(max_buffer_size));
+            if (b == nullptr) {
+                while (first != nullptr) {
+                    buffer* next = first->next.load(std::memory_order_relaxed);
+                    recycle(first);
+                    first = next;
+                }
+                return rap_err_output_buffer_too_small;
+            }
+            char* dst = b->data();
+            while (b->size < capacity(b)) {
+                while (src_len == 0) {
+                    src = static_cast<const char*>(iov->iov_base);
+                    src_len = iov->iov_len;
+                    ++iov;
+                    if (skip > 0) {
+                        size_t n = skip < src_len ? skip : src_len;
+                        src += n;
+                        src_len -= n;
+                        skip -= n;
+                    }
+                }
+                size_t n = capacity(b) - b->size;
+                if (n > src_len)
+                    n = src_len;
+                memcpy(dst + b->size, src, n);
+                b->size += n;
+                src += n;
+                src_len -= n;
+            }
+            left -= b->size;
+            if (last != nullptr)
+                last->next.store(b, std::memory_order_relaxed);
+            else
+                first = b;
+            last = b;
+        }
+        if (first != nullptr)
+            link(first, last);
+        return rap_err_ok;
+    }
+
+    /**
+     * @brief pop() returns the oldest buffer, or nullptr if there is none
+     * or the next one is still being pushed. Consumer only.
+     */
+    buffer* pop()
+    {
+        buffer* tail = tail_;
+        buffer* next = tail->next.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (next == nullptr)
+                return nullptr;
+            tail_ = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next != nullptr) {
+            tail_ = next;
+            return tail;
+        }
+        if (tail != head_.load(std::memory_order_acquire))
+            return nullptr;
+        stub_.next.store(nullptr, std::memory_order_relaxed);
+        link(&stub_, &stub_);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next != nullptr) {
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief empty() returns true if nothing has been pushed that
+     * hasn't been popped. Consumer only.
+     */
+    bool empty() const
+    {
+        return tail_ == &stub_ && head_.load(std::memory_order_acquire) == &stub_;
+    }
+
+    /**
+     * @brief recycle() returns a buffer from pop() to the pool.
+     */
+    static void recycle(buffer* b)
+    {
+        b->~buffer();
+        framepool::destroy(frame_of(b));
+    }
+
+private:
+    std::atomic<buffer*> head_; // most recently pushed
+    buffer* tail_; // next to pop
+    buffer stub_;
+
+    // the buffer lives in the payload of a framepool frame
+    static buffer* create(size_t size)
+    {
+        rap_frame* f = framepool::create(frame_pad + sizeof(buffer) + size);
+        if (f == nullptr)
+            return nullptr;
+        buffer* b = new (f->payload() + frame_pad) buffer;
+        b->next.store(nullptr, std::memory_order_relaxed);
+        b->size = 0;
+        return b;
+    }
+
+    static rap_frame* frame_of(buffer* b)
+    {
+        return reinterpret_cast<rap_frame*>(reinterpret_cast<char*>(b) - frame_pad - rap_frame_header_size);
+    }
+
+    static size_t capacity(buffer* b)
+    {
+        return framepool::block::of(frame_of(b))->limit - frame_pad - sizeof(buffer);
+    }
+
+    // appends the chain first..last, whose last link must be nullptr
+    void link(buffer* first, buffer* last)
+    {
+        buffer* prev = head_.exchange(last, std::memory_order_acq_rel);
+        prev->next.store(first, std::memory_order_release);
+    }
+};
+
+} // namespace rap
+
+#endif // RAP_SENDQUEUE_HPP
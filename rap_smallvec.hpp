@@ -0,0 +1,144 @@
+#ifndef RAP_SMALLVEC_HPP
+#define RAP_SMALLVEC_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+
+namespace rap {
+
+/**
+ * @brief smallvec is a vector that keeps its first N elements inside
+ * the object, and only allocates when it grows past them.
+ *
+ * Only the subset of std::vector that rap needs is provided.
+ */
+template <typename T, size_t N>
+class smallvec {
+public:
+    typedef T value_type;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    smallvec()
+        : ptr_(inline_ptr())
+        , size_(0)
+        , capacity_(N)
+    {
+    }
+
+    smallvec(const smallvec& other)
+        : ptr_(inline_ptr())
+        , size_(0)
+        , capacity_(N)
+    {
+        append(other);
+    }
+
+    ~smallvec()
+    {
+        clear();
+        if (ptr_ != inline_ptr())
+            ::operator delete(ptr_);
+    }
+
+    smallvec& operator=(const smallvec& other)
+    {
+        if (this != &other) {
+            clear();
+            append(other);
+        }
+        return *this;
+    }
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    bool empty() const { return !size_; }
+
+    /**
+     * @brief is_inline() returns true if no memory has been allocated.
+     */
+    bool is_inline() const { return ptr_ == inline_ptr(); }
+
+    T& operator[](size_t n)
+    {
+        assert(n < size_);
+        return ptr_[n];
+    }
+
+    const T& operator[](size_t n) const
+    {
+        assert(n < size_);
+        return ptr_[n];
+    }
+
+    T& at(size_t n)
+    {
+        if (n >= size_)
+            throw std::out_of_range("rap::smallvec");
+        return ptr_[n];
+    }
+
+    const T& at(size_t n) const
+    {
+        if (n >= size_)
+            throw std::out_of_range("rap::smallvec");
+        return ptr_[n];
+    }
+
+    iterator begin() { return ptr_; }
+    iterator end() { return ptr_ + size_; }
+    const_iterator begin() const { return ptr_; }
+    const_iterator end() const { return ptr_ + size_; }
+
+    void push_back(const T& v)
+    {
+        if (size_ == capacity_)
+            reserve(capacity_ * 2);
+        new (ptr_ + size_) T(v);
+        ++size_;
+    }
+
+    void clear()
+    {
+        while (size_ > 0)
+            ptr_[--size_].~T();
+    }
+
+    void reserve(size_t n)
+    {
+        if (n <= capacity_)
+            return;
+        T* p = static_cast<T*>(::operator new(n * sizeof(T)));
+        for (size_t i = 0; i < size_; ++i) {
+            new (p + i) T(ptr_[i]);
+            ptr_[i].~T();
+        }
+        if (ptr_ != inline_ptr())
+            ::operator delete(ptr_);
+        ptr_ = p;
+        capacity_ = n;
+    }
+
+private:
+    T* ptr_;
+    size_t size_;
+    size_t capacity_;
+    typename std::aligned_storage<sizeof(T) * N, std::alignment_of<T>::value>::type inline_;
+
+    T* inline_ptr() { return reinterpret_cast<T*>(&inline_); }
+    const T* inline_ptr() const { return reinterpret_cast<const T*>(&inline_); }
+
+    void append(const smallvec& other)
+    {
+        reserve(size_ + other.size_);
+        for (size_t i = 0; i < other.size_; ++i)
+            push_back(other.ptr_[i]);
+    }
+};
+
+} // namespace rap
+
+#endif // RAP_SMALLVEC_HPP
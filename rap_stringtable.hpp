@@ -0,0 +1,158 @@
+#ifndef RAP_STRINGTABLE_HPP
+#define RAP_STRINGTABLE_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "rap.hpp"
+#include "rap_constants.h"
+#include "rap_text.hpp"
+
+namespace rap {
+
+/**
+ * @brief stringtable holds the strings one side of a link has defined
+ * for the other, so that they can be sent as a single key byte.
+ *
+ * Keys from first_key up are dynamic, below that they belong to the
+ * static textmap. The sending side defines a string with add(), which
+ * evicts the oldest definitions first when the table is out of keys
+ * or over its byte budget, and finds them with find() while encoding.
+ * The receiving side mirrors the definitions with set() and resolves
+ * keys with get().
+ */
+class stringtable {
+public:
+    enum {
+        first_key = 0x80,
+        max_entries = 0x80,
+        index_size = max_entries * 2 /**< open addressing slots for find() */
+    };
+
+    stringtable()
+        : budget_(rap_string_table_size)
+        , bytes_(0)
+        , count_(0)
+        , oldest_(0)
+    {
+        memset(index_, 0, sizeof(index_));
+    }
+
+    size_t budget() const { return budget_; }
+    void set_budget(size_t n) { budget_ = n; }
+    size_t bytes() const { return bytes_; }
+    size_t count() const { return count_; }
+
+    /**
+     * @brief get() returns the string for @a key, or a null text.
+     */
+    text get(unsigned key) const
+    {
+        if (key < first_key || key >= first_key + max_entries)
+            return text();
+        const std::string& s = strings_[key - first_key];
+        return s.empty() ? text() : text(s.data(), s.size());
+    }
+
+    /**
+     * @brief set() stores a definition received from the peer.
+     */
+    void set(unsigned key, const char* src_ptr, size_t src_len)
+    {
+        assert(key >= first_key && key < first_key + max_entries);
+        std::string& s = strings_[key - first_key];
+        bytes_ -= s.size();
+        s.assign(src_ptr, src_len);
+        bytes_ += s.size();
+    }
+
+    /**
+     * @brief find() returns the key of a string defined with add(),
+     * or zero.
+     */
+    unsigned find(const char* src_ptr, size_t src_len) const
+    {
+        if (!count_ || !src_len)
+            return 0;
+        for (size_t i = hash(src_ptr, src_len);; i = (i + 1) % index_size) {
+            unsigned key = index_[i];
+            if (!key)
+                return 0;
+            const std::string& s = strings_[key - first_key];
+            if (s.size() == src_len && !memcmp(s.data(), src_ptr, src_len))
+                return key;
+        }
+    }
+
+    /**
+     * @brief add() defines a new string and returns its key, evicting
+     * old definitions if @a can_evict is set and there is no room.
+     * Returns zero if the string can't be added.
+     */
+    unsigned add(const char* src_ptr, size_t src_len, bool can_evict)
+    {
+        assert(!find(src_ptr, src_len));
+        if (!src_len || src_len > budget_ || src_len >= 0x8000)
+            return 0;
+        while (count_ == max_entries || bytes_ + src_len > budget_) {
+            if (!can_evict)
+                return 0;
+            evict();
+        }
+        unsigned key = first_key + static_cast<unsigned>((oldest_ + count_) % max_entries);
+        ++count_;
+        set(key, src_ptr, src_len);
+        size_t i = hash(src_ptr, src_len);
+        while (index_[i])
+            i = (i + 1) % index_size;
+        index_[i] = static_cast<uint8_t>(key);
+        return key;
+    }
+
+private:
+    size_t budget_;
+    size_t bytes_;
+    size_t count_;
+    size_t oldest_;
+    uint8_t index_[index_size];
+    std::string strings_[max_entries];
+
+    static size_t hash(const char* p, size_t n)
+    {
+        uint32_t h = 2166136261u;
+        while (n-- > 0)
+            h = (h ^ static_cast<unsigned char>(*p++)) * 16777619u;
+        return h % index_size;
+    }
+
+    void evict()
+    {
+        assert(count_ > 0);
+        unsigned key = first_key + static_cast<unsigned>(oldest_);
+        std::string& s = strings_[oldest_];
+        size_t i = hash(s.data(), s.size());
+        while (index_[i] != key)
+            i = (i + 1) % index_size;
+        index_[i] = 0;
+        // re-insert the rest of the cluster so probing stays unbroken
+        for (size_t j = (i + 1) % index_size; index_[j]; j = (j + 1) % index_size) {
+            unsigned k = index_[j];
+            index_[j] = 0;
+            const std::string& t = strings_[k - first_key];
+            size_t m = hash(t.data(), t.size());
+            while (index_[m])
+                m = (m + 1) % index_size;
+            index_[m] = static_cast<uint8_t>(k);
+        }
+        bytes_ -= s.size();
+        s.clear();
+        oldest_ = (oldest_ + 1) % max_entries;
+        --count_;
+    }
+};
+
+} // namespace rap
+
+#endif // RAP_STRINGTABLE_HPP
@@ -3,11 +3,13 @@
 
 #include "rap.hpp"
 
-// defined in rap_textmap.c, generated from rap_textmap.gperf using GNU gperf.
+// defined in rap_textmap.cpp, the words are listed in rap_textmap.def.
 extern "C" {
 unsigned int rap_textmap_max_key();
 const char* rap_textmap_from_key(unsigned int key, size_t* p_len);
 unsigned int rap_textmap_to_key(const char* str, size_t len);
+// like rap_textmap_to_key(), but only for header names and ignoring case
+unsigned int rap_textmap_header_to_key(const char* str, size_t len);
 }
 
 namespace rap {
@@ -17,30 +19,37 @@ public:
     text()
         : data_(NULL)
         , size_(0)
+        , key_(0)
     {
     }
 
     text(const text& other)
         : data_(other.data_)
         , size_(other.size_)
+        , key_(other.key_)
     {
     }
 
     explicit text(const char* ptr, size_t len)
         : data_(ptr)
         , size_(len)
+        , key_(0)
     {
     }
 
     explicit text(unsigned char map_index)
+        : key_(0)
     {
         data_ = rap_textmap_from_key(static_cast<unsigned>(map_index), &size_);
+        if (data_ && map_index > 1)
+            key_ = map_index;
     }
 
     text& operator=(const text& other)
     {
         data_ = other.data_;
         size_ = other.size_;
+        key_ = other.key_;
         return *this;
     }
 
@@ -56,7 +65,9 @@ public:
 
     bool operator!=(const char* c_str) const { return !operator==(c_str); }
 
-    void render(string_t& out) const
+    // Out is a string_t or anything else with append(const char*, size_t)
+    template <typename Out>
+    void render(Out& out) const
     {
         if (!empty())
             out.append(data(), size());
@@ -74,11 +85,32 @@ public:
     const char* data() const { return data_; }
     size_t size() const { return size_; }
 
+    /**
+     * @brief key() returns the textmap key the text was decoded from,
+     * or zero if it was sent in full.
+     */
+    unsigned key() const { return key_; }
+
 private:
     const char* data_;
     size_t size_;
+    unsigned key_;
 };
 
+/**
+ * @brief symbol() returns the textmap key of the header name @a c_str
+ * in any case, or zero if it has none.
+ *
+ * Well known header names always arrive as keys, so a symbol can be
+ * looked up with an integer compare, as in kvv::find(unsigned).
+ * Callers normally keep the result in a static.
+ */
+inline unsigned symbol(const char* c_str)
+{
+    unsigned key = rap_textmap_header_to_key(c_str, strlen(c_str));
+    return key > 1 ? key : 0;
+}
+
 } // namespace rap
 
 #endif // RAP_TEXT_HPP
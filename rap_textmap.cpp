@@ -0,0 +1,218 @@
+/*
+ * rap_textmap.cpp - the static text map
+ *
+ * Maps the words listed in rap_textmap.def to single byte keys and back.
+ * The hash table is built at compile time, so adding a word only needs
+ * a new line in rap_textmap.def.
+ *
+ * The hash folds ASCII case, so that header names can be looked up
+ * without regard to case while other words still match exactly.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+struct word {
+    unsigned key;
+    const char* str;
+    size_t len;
+    bool header;
+};
+
+constexpr word words[] = {
+#define RAP_TEXTMAP_WORD(key, str, header) { key, str, sizeof(str) - 1, header != 0 },
+#include "rap_textmap.def"
+#undef RAP_TEXTMAP_WORD
+};
+
+constexpr size_t num_words = sizeof(words) / sizeof(words[0]);
+
+enum {
+    num_buckets = 256,
+    bucket_size = 2,
+    num_keys = 0x80,
+    min_len = 2,
+    max_len = 32,
+};
+
+constexpr unsigned fold(char ch)
+{
+    return static_cast<unsigned char>(ch) | 0x20;
+}
+
+constexpr unsigned hash(const char* s, size_t n)
+{
+    return (n * 114 + fold(s[0]) * 83 + fold(s[n - 1]) * 86 + fold(s[1]) * 85
+               + fold(s[n - 2]) * 202 + fold(s[n / 2]) * 51)
+        & (num_buckets - 1);
+}
+
+// index + 1 of the nth word from i on that hashes to bucket b, or zero
+constexpr uint8_t find_in_bucket(unsigned b, unsigned nth, size_t i = 0)
+{
+    return i >= num_words
+        ? 0
+        : hash(words[i].str, words[i].len) != b
+            ? find_in_bucket(b, nth, i + 1)
+            : nth ? find_in_bucket(b, nth - 1, i + 1) : static_cast<uint8_t>(i + 1);
+}
+
+// index + 1 of the word with the given key, or zero
+constexpr uint8_t find_key(unsigned key, size_t i = 0)
+{
+    return i >= num_words
+        ? 0
+        : words[i].key == key ? static_cast<uint8_t>(i + 1) : find_key(key, i + 1);
+}
+
+template <size_t... I>
+struct seq {
+    typedef seq<I..., (sizeof...(I) + I)...> doubled;
+};
+
+template <size_t N>
+struct make_seq {
+    typedef typename make_seq<N / 2>::type::doubled type;
+};
+
+template <>
+struct make_seq<1> {
+    typedef seq<0> type;
+};
+
+template <typename S>
+struct slot_table;
+
+template <size_t... I>
+struct slot_table<seq<I...> > {
+    static constexpr uint8_t slots[sizeof...(I)] = { find_in_bucket(I / bucket_size, I % bucket_size)... };
+};
+
+template <size_t... I>
+constexpr uint8_t slot_table<seq<I...> >::slots[sizeof...(I)];
+
+template <typename S>
+struct key_table;
+
+template <size_t... I>
+struct key_table<seq<I...> > {
+    static constexpr uint8_t words_of[sizeof...(I)] = { find_key(I)... };
+};
+
+template <size_t... I>
+constexpr uint8_t key_table<seq<I...> >::words_of[sizeof...(I)];
+
+// word index + 1 for each hash bucket slot
+const uint8_t* const slots = slot_table<make_seq<num_buckets * bucket_size>::type>::slots;
+
+// word index + 1 for each key
+const uint8_t* const keys = key_table<make_seq<num_keys>::type>::words_of;
+
+// build time checks of rap_textmap.def
+
+constexpr bool buckets_fit(unsigned b = 0)
+{
+    return b >= num_buckets || (!find_in_bucket(b, bucket_size) && buckets_fit(b + 1));
+}
+
+constexpr size_t count_key(unsigned key, size_t i = 0)
+{
+    return i >= num_words ? 0 : (words[i].key == key) + count_key(key, i + 1);
+}
+
+constexpr bool words_valid(size_t i = 0)
+{
+    return i >= num_words
+        || (words[i].key >= 2 && words[i].key < num_keys
+            && words[i].len >= min_len && words[i].len <= max_len
+            && count_key(words[i].key) == 1 && words_valid(i + 1));
+}
+
+constexpr unsigned max_key(size_t i = 0, unsigned k = 0)
+{
+    return i >= num_words ? k : max_key(i + 1, words[i].key > k ? words[i].key : k);
+}
+
+static_assert(words_valid(), "rap_textmap.def keys must be unique and in 2..127, words 2..32 chars");
+static_assert(buckets_fit(), "rap_textmap.def has too many hash collisions, adjust hash()");
+
+uint64_t load(const char* p, size_t n)
+{
+    uint64_t v = 0;
+    memcpy(&v, p, n < 8 ? n : 8);
+    return v;
+}
+
+bool equal(const char* a, const char* b, size_t n)
+{
+    for (; n > 8; n -= 8, a += 8, b += 8)
+        if (load(a, 8) != load(b, 8))
+            return false;
+    return load(a, n) == load(b, n);
+}
+
+// true if x matches the ASCII word w in all but the case of letters
+bool iequal8(uint64_t x, uint64_t w)
+{
+    const uint64_t ones = 0x0101010101010101ull;
+    uint64_t wl = w | (ones * 0x20);
+    uint64_t letters = ((wl + ones * (0x80 - 'a')) & ~(wl + ones * (0x7f - 'z')) & (ones * 0x80)) >> 2;
+    return ((x ^ w) & ~letters) == 0;
+}
+
+bool iequal(const char* a, const char* w, size_t n)
+{
+    for (; n > 8; n -= 8, a += 8, w += 8)
+        if (!iequal8(load(a, 8), load(w, 8)))
+            return false;
+    return iequal8(load(a, n), load(w, n));
+}
+
+unsigned lookup(const char* str, size_t len, bool header)
+{
+    if (len < min_len || len > max_len)
+        return 0;
+    const uint8_t* slot = slots + hash(str, len) * bucket_size;
+    for (size_t n = 0; n < bucket_size && slot[n]; ++n) {
+        const word& w = words[slot[n] - 1];
+        if (w.len != len)
+            continue;
+        if (header ? w.header && iequal(str, w.str, len) : equal(str, w.str, len))
+            return w.key;
+    }
+    return 0;
+}
+
+} // namespace
+
+extern "C" unsigned int rap_textmap_max_key()
+{
+    return max_key();
+}
+
+extern "C" const char* rap_textmap_from_key(unsigned int key, size_t* p_len)
+{
+    *p_len = 0;
+    if (key < 2 || key >= num_keys || !keys[key])
+        return key == 1 ? "" : nullptr;
+    const word& w = words[keys[key] - 1];
+    *p_len = w.len;
+    return w.str;
+}
+
+extern "C" unsigned int rap_textmap_to_key(const char* str, size_t len)
+{
+    if (!len)
+        return 1;
+    return lookup(str, len, false);
+}
+
+extern "C" unsigned int rap_textmap_header_to_key(const char* str, size_t len)
+{
+    if (!len)
+        return 1;
+    return lookup(str, len, true);
+}
@@ -0,0 +1,220 @@
+#ifndef RAP_TRACE_HPP
+#define RAP_TRACE_HPP
+
+/*
+ * rap_trace.hpp - binary capture of the frames on a link
+ *
+ * Compiled in unless RAP_TRACE is defined to 0. A link without a tracer
+ * attached pays one pointer test per frame.
+ */
+
+#ifndef RAP_TRACE
+#if defined(_WIN32)
+#define RAP_TRACE 0
+#else
+#define RAP_TRACE 1
+#endif
+#endif
+
+#if RAP_TRACE
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "rap_frame.h"
+
+namespace rap {
+
+/**
+ * @brief tracer records frames into a ring in a memory mapped file.
+ *
+ * The file starts with a file_header, followed by the ring, where each
+ * entry is a record followed by the captured bytes, padded to a multiple
+ * of eight. An entry holds one or more whole frames as they were read or
+ * written, of which at most snaplen bytes are kept.
+ *
+ * Any number of threads may record at the same time. Space is claimed
+ * with a compare-and-swap on the ring head, and an entry never wraps
+ * around the end of the ring. Its pos field is stored last, so an entry
+ * is only valid if pos matches where it lies in the ring, which also lets
+ * a reader find the oldest entry that hasn't been overwritten.
+ */
+class tracer {
+public:
+    enum {
+        file_magic = 0x54504152, // "RAPT"
+        file_version = 1,
+        entry_align = 8
+    };
+
+    enum direction {
+        dir_recv = 0,
+        dir_send = 1,
+        dir_pad = 0xff // rest of the ring is unused this lap
+    };
+
+    struct file_header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t capacity; // bytes in the ring, a power of two
+        uint64_t snaplen;
+        uint64_t head; // ring position where the next entry goes
+        char reserved[32];
+    };
+
+    struct record {
+        uint64_t pos; // ring position of this entry
+        uint64_t time_ns; // CLOCK_REALTIME
+        uint32_t link; // chosen when the tracer was attached
+        uint32_t length; // bytes read or written
+        uint32_t size; // bytes captured, following the record
+        uint8_t dir;
+        uint8_t reserved[3];
+    };
+
+    tracer()
+        : hdr_(static_cast<file_header*>(MAP_FAILED))
+        , ring_(nullptr)
+        , map_size_(0)
+        , mask_(0)
+        , snaplen_(0)
+    {
+    }
+
+    ~tracer() { close(); }
+
+    /**
+     * @brief open() creates the file at @a path with a ring of at least
+     * @a capacity bytes, keeping at most @a snaplen bytes of each entry,
+     * zero meaning all of it. The ring holds at least 1 MiB.
+     *
+     * @return 0, or a negative errno value
+     */
+    int open(const char* path, size_t capacity, size_t snaplen)
+    {
+        close();
+        size_t cap = 0x100000;
+        while (cap < capacity)
+            cap <<= 1;
+        int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return -errno;
+        map_size_ = sizeof(file_header) + cap;
+        int err = 0;
+        if (ftruncate(fd, static_cast<off_t>(map_size_)) < 0)
+            err = -errno;
+        else {
+            void* p = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED)
+                err = -errno;
+            else
+                hdr_ = static_cast<file_header*>(p);
+        }
+        ::close(fd);
+        if (err)
+            return err;
+        ring_ = reinterpret_cast<char*>(hdr_ + 1);
+        mask_ = cap - 1;
+        // an entry is at most two frames, and must fit the ring
+        snaplen_ = 2 * rap_frame_max_size;
+        if (snaplen && snaplen < snaplen_)
+            snaplen_ = snaplen;
+        hdr_->version = file_version;
+        hdr_->capacity = cap;
+        hdr_->snaplen = snaplen_;
+        hdr_->head = 0;
+        __atomic_store_n(&hdr_->magic, static_cast<uint32_t>(file_magic), __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    void close()
+    {
+        if (hdr_ != MAP_FAILED)
+            munmap(hdr_, map_size_);
+        hdr_ = static_cast<file_header*>(MAP_FAILED);
+        ring_ = nullptr;
+    }
+
+    /**
+     * @brief write() records the @a a_len bytes at @a a followed by the
+     * @a b_len bytes at @a b as one entry for @a link.
+     */
+    void write(uint32_t link, direction dir, const char* a, size_t a_len,
+        const char* b = nullptr, size_t b_len = 0)
+    {
+        size_t length = a_len + b_len;
+        size_t size = length < snaplen_ ? length : snaplen_;
+        uint64_t pos = reserve(entry_size(size));
+        record* r = reinterpret_cast<record*>(ring_ + (pos & mask_));
+        char* dst = reinterpret_cast<char*>(r + 1);
+        size_t n = a_len < size ? a_len : size;
+        memcpy(dst, a, n);
+        if (b_len > 0 && size > n)
+            memcpy(dst + n, b, size - n);
+        r->time_ns = now();
+        r->link = link;
+        r->length = static_cast<uint32_t>(length);
+        r->size = static_cast<uint32_t>(size);
+        r->dir = static_cast<uint8_t>(dir);
+        __atomic_store_n(&r->pos, pos, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief entry_size() returns the ring space taken by an entry with
+     * @a size captured bytes.
+     */
+    static size_t entry_size(size_t size)
+    {
+        return (sizeof(record) + size + entry_align - 1) & ~static_cast<size_t>(entry_align - 1);
+    }
+
+private:
+    file_header* hdr_;
+    char* ring_;
+    size_t map_size_;
+    uint64_t mask_;
+    size_t snaplen_;
+
+    // claims room for an entry of @a n bytes that doesn't wrap around
+    // the ring, padding out the current lap if needed
+    uint64_t reserve(size_t n)
+    {
+        uint64_t head = __atomic_load_n(&hdr_->head, __ATOMIC_RELAXED);
+        for (;;) {
+            uint64_t room = mask_ + 1 - (head & mask_);
+            uint64_t pos = room < n ? head + room : head;
+            if (__atomic_compare_exchange_n(&hdr_->head, &head, pos + n, true,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                if (pos != head && room >= sizeof(record)) {
+                    record* pad = reinterpret_cast<record*>(ring_ + (head & mask_));
+                    pad->dir = dir_pad;
+                    pad->size = 0;
+                    __atomic_store_n(&pad->pos, head, __ATOMIC_RELEASE);
+                }
+                return pos;
+            }
+        }
+    }
+
+    static uint64_t now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    tracer(const tracer&);
+    tracer& operator=(const tracer&);
+};
+
+} // namespace rap
+
+#endif // RAP_TRACE
+
+#endif // RAP_TRACE_HPP
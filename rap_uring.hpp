@@ -0,0 +1,323 @@
+#ifndef RAP_URING_HPP
+#define RAP_URING_HPP
+
+/*
+ * rap_uring.hpp - a minimal io_uring instance
+ *
+ * Only built when HAVE_IO_URING is defined and the kernel headers know
+ * about multishot receive, provided buffer rings and zero-copy send, in
+ * which case RAP_URING is defined to 1. No liburing is needed.
+ */
+
+#if defined(__linux__) && defined(HAVE_IO_URING)
+#include <linux/io_uring.h>
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT) && defined(IORING_CQE_F_NOTIF)
+#define RAP_URING 1
+#endif
+#endif
+
+#ifndef RAP_URING
+#define RAP_URING 0
+#endif
+
+#if RAP_URING
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace rap {
+
+/**
+ * @brief uring is an io_uring instance set up with the raw system calls.
+ *
+ * It is owned by a single thread: get_sqe() fills submission entries,
+ * submit() hands them to the kernel and optionally waits, and
+ * for_each_cqe() consumes the completions.
+ */
+class uring {
+public:
+    uring()
+        : fd_(-1)
+        , ring_(MAP_FAILED)
+        , ring_size_(0)
+        , sqes_(static_cast<io_uring_sqe*>(MAP_FAILED))
+        , sq_entries_(0)
+        , sqe_tail_(0)
+        , sqe_submitted_(0)
+    {
+    }
+
+    ~uring() { close(); }
+
+    /**
+     * @brief init() creates the ring with room for @a entries
+     * submissions.
+     *
+     * @return 0, or a negative errno value
+     */
+    int init(unsigned entries)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_COOP_TASKRUN;
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        if (fd_ < 0 && errno == EINVAL) {
+            // kernels before 5.19 don't know the flag
+            memset(&p, 0, sizeof(p));
+            fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        }
+        if (fd_ < 0)
+            return -errno;
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+            close();
+            return -ENOSYS;
+        }
+        size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        ring_size_ = sq_size > cq_size ? sq_size : cq_size;
+        ring_ = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (ring_ == MAP_FAILED) {
+            int err = -errno;
+            close();
+            return err;
+        }
+        sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+        if (sqes_ == MAP_FAILED) {
+            int err = -errno;
+            close();
+            return err;
+        }
+        char* ring = static_cast<char*>(ring_);
+        sq_head_ = reinterpret_cast<unsigned*>(ring + p.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(ring + p.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(ring + p.sq_off.ring_mask);
+        cq_head_ = reinterpret_cast<unsigned*>(ring + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(ring + p.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(ring + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(ring + p.cq_off.cqes);
+        sq_entries_ = p.sq_entries;
+        sqe_tail_ = sqe_submitted_ = *sq_tail_;
+        // SQEs are always used in order, so the index array never changes
+        unsigned* sq_array = reinterpret_cast<unsigned*>(ring + p.sq_off.array);
+        for (unsigned i = 0; i < p.sq_entries; ++i)
+            sq_array[i] = i;
+        return 0;
+    }
+
+    void close()
+    {
+        if (sqes_ != MAP_FAILED)
+            munmap(sqes_, sq_entries_ * sizeof(io_uring_sqe));
+        if (ring_ != MAP_FAILED)
+            munmap(ring_, ring_size_);
+        if (fd_ >= 0)
+            ::close(fd_);
+        sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+        ring_ = MAP_FAILED;
+        fd_ = -1;
+    }
+
+    int fd() const { return fd_; }
+
+    /**
+     * @brief get_sqe() returns a cleared submission entry, submitting
+     * the pending ones first if the queue is full, or nullptr.
+     */
+    io_uring_sqe* get_sqe()
+    {
+        if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+            if (submit(0) < 0 || sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_)
+                return nullptr;
+        }
+        io_uring_sqe* sqe = &sqes_[sqe_tail_ & sq_mask_];
+        memset(sqe, 0, sizeof(*sqe));
+        ++sqe_tail_;
+        return sqe;
+    }
+
+    /**
+     * @brief sq_space() returns how many entries get_sqe() can return
+     * without having to submit.
+     */
+    unsigned sq_space() const
+    {
+        return sq_entries_ - (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE));
+    }
+
+    /**
+     * @brief submit() hands the new submission entries to the kernel,
+     * waiting for at least @a wait_nr completions.
+     *
+     * @return the number of entries submitted, or a negative errno value
+     */
+    int submit(unsigned wait_nr)
+    {
+        __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+        unsigned to_submit = sqe_tail_ - sqe_submitted_;
+        if (to_submit == 0 && wait_nr == 0)
+            return 0;
+        int rv;
+        do {
+            rv = static_cast<int>(syscall(__NR_io_uring_enter, fd_, to_submit, wait_nr,
+                wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+        } while (rv < 0 && errno == EINTR && wait_nr == 0);
+        if (rv < 0)
+            return -errno;
+        sqe_submitted_ += static_cast<unsigned>(rv);
+        return rv;
+    }
+
+    /**
+     * @brief for_each_cqe() calls @a fn for each completion and then
+     * marks them all as seen.
+     *
+     * @return the number of completions
+     */
+    template <typename Fn>
+    unsigned for_each_cqe(Fn fn)
+    {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        unsigned n = tail - head;
+        for (; head != tail; ++head)
+            fn(cqes_[head & cq_mask_]);
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    /**
+     * @brief register_buffers() registers memory for the fixed buffer
+     * operations, such as IORING_OP_SEND_ZC with IORING_RECVSEND_FIXED_BUF.
+     *
+     * @return 0, or a negative errno value
+     */
+    int register_buffers(const struct iovec* iov, unsigned n)
+    {
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, iov, n) < 0)
+            return -errno;
+        return 0;
+    }
+
+    /**
+     * @brief bufring is a provided buffer ring, from which the kernel
+     * picks a buffer for each receive using IOSQE_BUFFER_SELECT.
+     */
+    class bufring {
+    public:
+        bufring()
+            : ring_(nullptr)
+            , mem_(static_cast<char*>(MAP_FAILED))
+            , entries_(0)
+            , buf_size_(0)
+            , bgid_(0)
+        {
+        }
+
+        ~bufring() { free(); }
+
+        /**
+         * @brief init() registers @a entries buffers of @a buf_size
+         * bytes as buffer group @a bgid of @a u. @a entries must be a
+         * power of two.
+         *
+         * @return 0, or a negative errno value
+         */
+        int init(uring& u, unsigned entries, size_t buf_size, unsigned short bgid)
+        {
+            size_t ring_size = entries * sizeof(io_uring_buf);
+            mem_ = static_cast<char*>(mmap(nullptr, ring_size + entries * buf_size,
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if (mem_ == MAP_FAILED)
+                return -errno;
+            entries_ = entries;
+            buf_size_ = buf_size;
+            bgid_ = bgid;
+            ring_ = reinterpret_cast<io_uring_buf_ring*>(mem_);
+            io_uring_buf_reg reg;
+            memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = reinterpret_cast<uintptr_t>(ring_);
+            reg.ring_entries = entries;
+            reg.bgid = bgid;
+            if (syscall(__NR_io_uring_register, u.fd(), IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+                int err = -errno;
+                free();
+                return err;
+            }
+            ring_->tail = 0;
+            for (unsigned bid = 0; bid < entries; ++bid)
+                put(bid, bid);
+            __atomic_store_n(&ring_->tail, static_cast<unsigned short>(entries), __ATOMIC_RELEASE);
+            return 0;
+        }
+
+        unsigned short bgid() const { return bgid_; }
+        size_t buf_size() const { return buf_size_; }
+        char* data(unsigned bid) { return mem_ + entries_ * sizeof(io_uring_buf) + bid * buf_size_; }
+
+        /**
+         * @brief recycle() gives buffer @a bid back to the kernel.
+         */
+        void recycle(unsigned bid)
+        {
+            unsigned short tail = ring_->tail;
+            put(tail, bid);
+            __atomic_store_n(&ring_->tail, static_cast<unsigned short>(tail + 1), __ATOMIC_RELEASE);
+        }
+
+    private:
+        io_uring_buf_ring* ring_;
+        char* mem_;
+        unsigned entries_;
+        size_t buf_size_;
+        unsigned short bgid_;
+
+        void put(unsigned slot, unsigned bid)
+        {
+            // not ring_->bufs, which C++ places after an empty struct
+            io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(mem_) + (slot & (entries_ - 1));
+            buf->addr = reinterpret_cast<uintptr_t>(data(bid));
+            buf->len = static_cast<unsigned>(buf_size_);
+            buf->bid = static_cast<unsigned short>(bid);
+        }
+
+        void free()
+        {
+            if (mem_ != MAP_FAILED)
+                munmap(mem_, entries_ * (sizeof(io_uring_buf) + buf_size_));
+            mem_ = static_cast<char*>(MAP_FAILED);
+            ring_ = nullptr;
+        }
+    };
+
+private:
+    int fd_;
+    void* ring_;
+    size_t ring_size_;
+    io_uring_sqe* sqes_;
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned sq_mask_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    io_uring_cqe* cqes_;
+    unsigned sq_entries_;
+    unsigned sqe_tail_; // next SQE to fill
+    unsigned sqe_submitted_; // SQEs the kernel has been given
+
+    uring(const uring&);
+    uring& operator=(const uring&);
+};
+
+} // namespace rap
+
+#endif // RAP_URING
+
+#endif // RAP_URING_HPP
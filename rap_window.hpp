@@ -0,0 +1,185 @@
+#ifndef RAP_WINDOW_HPP
+#define RAP_WINDOW_HPP
+
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+
+#include "rap.hpp"
+#include "rap_constants.h"
+#include "rap_frame.h"
+
+namespace rap {
+
+/**
+ * @brief window_limits bounds the send window of the connections on a link.
+ *
+ * The frame limits are in frames in flight per connection, the byte limit
+ * in payload bytes in flight per connection.
+ */
+struct window_limits {
+    window_limits()
+        : min_frames(1)
+        , max_frames(rap_max_send_window)
+        , max_bytes(rap_max_send_window_limit * rap_frame_max_payload_size)
+    {
+    }
+
+    int min_frames;
+    int max_frames;
+    size_t max_bytes;
+};
+
+/**
+ * @brief window tracks the frames a connection has in flight and adapts the
+ * number it may have outstanding to the measured ACK round-trip time.
+ *
+ * While the connection has more to send than the window allows and the
+ * round-trip time stays close to the lowest seen, the window grows;
+ * doubling at first, then by one frame per round trip. When the round-trip
+ * time rises to twice the lowest seen, frames are queueing up somewhere on
+ * the path and the window shrinks by a quarter.
+ */
+class window {
+public:
+    window()
+        : size_(rap_max_send_window)
+        , min_size_(1)
+        , max_size_(rap_max_send_window)
+        , max_bytes_(0)
+        , in_flight_(0)
+        , bytes_in_flight_(0)
+        , head_(0)
+        , sent_seq_(0)
+        , acked_seq_(0)
+        , sample_seq_(0)
+        , sample_time_(0)
+        , min_rtt_(0)
+        , srtt_(0)
+        , limited_(false)
+        , slow_start_(true)
+    {
+    }
+
+    void init(const window_limits& limits, int initial)
+    {
+        min_size_ = clamp(limits.min_frames, 1, rap_max_send_window_limit);
+        max_size_ = clamp(limits.max_frames, min_size_, rap_max_send_window_limit);
+        max_bytes_ = limits.max_bytes;
+        size_ = clamp(initial, min_size_, max_size_);
+        in_flight_ = 0;
+        bytes_in_flight_ = 0;
+        head_ = 0;
+        sent_seq_ = 0;
+        acked_seq_ = 0;
+        sample_seq_ = 0;
+        sample_time_ = 0;
+        min_rtt_ = 0;
+        srtt_ = 0;
+        limited_ = false;
+        slow_start_ = true;
+    }
+
+    /**
+     * @brief set_max() changes the upper bound, such as after the peer
+     * has advertised what it is willing to receive.
+     */
+    void set_max(int max_frames)
+    {
+        max_size_ = clamp(max_frames, min_size_, rap_max_send_window_limit);
+        if (size_ > max_size_)
+            size_ = max_size_;
+    }
+
+    int size() const { return size_; }
+    int in_flight() const { return in_flight_; }
+    size_t bytes_in_flight() const { return bytes_in_flight_; }
+    int available() const { return size_ - in_flight_; }
+    uint32_t srtt_usec() const { return static_cast<uint32_t>(srtt_); }
+
+    /**
+     * @brief can_send() checks if a frame with @a payload_size bytes of
+     * payload may be sent now, and remembers if it couldn't.
+     */
+    bool can_send(size_t payload_size)
+    {
+        if (in_flight_ < size_
+            && (in_flight_ == 0 || bytes_in_flight_ + payload_size <= max_bytes_))
+            return true;
+        limited_ = true;
+        return false;
+    }
+
+    void on_send(size_t payload_size)
+    {
+        assert(in_flight_ < rap_max_send_window_limit);
+        sizes_[(head_ + in_flight_) % rap_max_send_window_limit] = static_cast<uint16_t>(payload_size);
+        ++in_flight_;
+        bytes_in_flight_ += payload_size;
+        ++sent_seq_;
+        if (!sample_time_) {
+            // no sample running, time this frame
+            sample_seq_ = sent_seq_;
+            sample_time_ = now_usec();
+        }
+    }
+
+    void on_ack(size_t count)
+    {
+        while (count-- > 0 && in_flight_ > 0) {
+            bytes_in_flight_ -= sizes_[head_];
+            head_ = (head_ + 1) % rap_max_send_window_limit;
+            --in_flight_;
+            ++acked_seq_;
+        }
+        if (sample_time_ && static_cast<int32_t>(acked_seq_ - sample_seq_) >= 0) {
+            on_rtt(now_usec() - sample_time_ + 1);
+            sample_time_ = 0;
+        }
+    }
+
+private:
+    int size_;
+    int min_size_;
+    int max_size_;
+    size_t max_bytes_;
+    int in_flight_;
+    size_t bytes_in_flight_;
+    int head_;
+    uint32_t sent_seq_;
+    uint32_t acked_seq_;
+    uint32_t sample_seq_;
+    uint64_t sample_time_;
+    uint64_t min_rtt_;
+    uint64_t srtt_;
+    bool limited_;
+    bool slow_start_;
+    uint16_t sizes_[rap_max_send_window_limit];
+
+    static int clamp(int n, int lo, int hi) { return n < lo ? lo : (n > hi ? hi : n); }
+
+    static uint64_t now_usec()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+                                         .count());
+    }
+
+    void on_rtt(uint64_t rtt)
+    {
+        if (min_rtt_ == 0 || rtt < min_rtt_)
+            min_rtt_ = rtt;
+        srtt_ = srtt_ ? (srtt_ * 7 + rtt) / 8 : rtt;
+        if (srtt_ >= min_rtt_ * 2 + 1) {
+            slow_start_ = false;
+            size_ = clamp(size_ - (size_ + 3) / 4, min_size_, max_size_);
+        } else if (limited_) {
+            size_ = clamp(slow_start_ ? size_ * 2 : size_ + 1, min_size_, max_size_);
+        }
+        limited_ = false;
+    }
+};
+
+} // namespace rap
+
+#endif // RAP_WINDOW_HPP
@@ -3,67 +3,277 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <streambuf>
 
 #include "rap.hpp"
+#include "rap_stringtable.hpp"
 #include "rap_text.hpp"
 
 namespace rap {
 
+/**
+ * @brief span_writer encodes into the raw memory range [ptr, end).
+ *
+ * Each value is only written if all of it fits, so nothing is left
+ * half written when the range runs out.
+ */
+class span_writer {
+public:
+    span_writer(char* ptr, char* end, const stringtable* strings = nullptr)
+        : ptr_(ptr)
+        , end_(end)
+        , strings_(strings)
+    {
+        assert(ptr <= end);
+    }
+
+    static size_t length_size(size_t n) { return n < 0x80 ? 1 : 2; }
+
+    static size_t uint64_size(uint64_t n)
+    {
+        size_t len = 1;
+        while (n >= 0x80) {
+            n >>= 7;
+            ++len;
+        }
+        return len;
+    }
+
+    /**
+     * @brief text_size() returns the number of bytes write_text() needs,
+     * and sets @a key to the textmap or @a strings key to use, or zero.
+     * If @a header_name is set, the textmap is searched ignoring case.
+     */
+    static size_t text_size(const char* src_ptr, size_t src_len, unsigned& key,
+        const stringtable* strings = nullptr, bool header_name = false)
+    {
+        key = 0;
+        if (!src_len)
+            return 2;
+        assert(src_ptr != nullptr);
+        key = header_name ? rap_textmap_header_to_key(src_ptr, src_len)
+                          : rap_textmap_to_key(src_ptr, src_len);
+        if (key != 0)
+            return 2;
+        if (strings && (key = strings->find(src_ptr, src_len)) != 0)
+            return 2;
+        return length_size(src_len) + src_len;
+    }
+
+    error write_length(size_t n)
+    {
+        if (n >= 0x8000)
+            return rap_err_string_too_long;
+        if (room() < length_size(n))
+            return rap_err_output_buffer_too_small;
+        ptr_ = put_length(ptr_, n);
+        return rap_err_ok;
+    }
+
+    error write_uint64(uint64_t n)
+    {
+        if (room() < 10 && room() < uint64_size(n))
+            return rap_err_output_buffer_too_small;
+        ptr_ = put_uint64(ptr_, n);
+        return rap_err_ok;
+    }
+
+    error write_int64(int64_t n) { return write_uint64(zigzag(n)); }
+
+    error write_text(const char* src_ptr, size_t src_len, bool header_name = false)
+    {
+        if (src_len >= 0x8000)
+            return rap_err_string_too_long;
+        unsigned key;
+        if (room() < text_size(src_ptr, src_len, key, strings_, header_name))
+            return rap_err_output_buffer_too_small;
+        ptr_ = put_text(ptr_, src_ptr, src_len, key);
+        return rap_err_ok;
+    }
+
+    error write_header_name(const char* src_ptr, size_t src_len)
+    {
+        return write_text(src_ptr, src_len, true);
+    }
+
+    error write(const char* src_ptr, size_t src_len)
+    {
+        if (room() < src_len)
+            return rap_err_output_buffer_too_small;
+        memcpy(ptr_, src_ptr, src_len);
+        ptr_ += src_len;
+        return rap_err_ok;
+    }
+
+    char* data() const { return ptr_; }
+    size_t room() const { return static_cast<size_t>(end_ - ptr_); }
+
+    static uint64_t zigzag(int64_t n)
+    {
+        uint64_t ux = static_cast<uint64_t>(n) << 1;
+        if (n < 0)
+            ux = ~ux;
+        return ux;
+    }
+
+    // the put_*() functions require the caller to have checked the room
+
+    static char* put_length(char* p, size_t n)
+    {
+        if (n < 0x80) {
+            *p++ = static_cast<char>(n);
+            return p;
+        }
+        *p++ = static_cast<char>((n >> 8) | 0x80);
+        *p++ = static_cast<char>(n);
+        return p;
+    }
+
+    static char* put_uint64(char* p, uint64_t n)
+    {
+        while (n >= 0x80) {
+            *p++ = static_cast<char>((n & 0x7f) | 0x80);
+            n >>= 7;
+        }
+        *p++ = static_cast<char>(n);
+        return p;
+    }
+
+    static char* put_text(char* p, const char* src_ptr, size_t src_len, unsigned key)
+    {
+        if (!src_len) {
+            *p++ = 0;
+            *p++ = src_ptr ? 1 : 0;
+            return p;
+        }
+        if (key) {
+            *p++ = 0;
+            *p++ = static_cast<char>(key);
+            return p;
+        }
+        p = put_length(p, src_len);
+        memcpy(p, src_ptr, src_len);
+        return p + src_len;
+    }
+
+private:
+    char* ptr_;
+    char* end_;
+    const stringtable* strings_;
+};
+
+/**
+ * @brief writer encodes into a std::streambuf.
+ *
+ * Values are encoded straight into the streambuf's put area when they
+ * fit, and only go through sputn() when the put area is full, which for
+ * a frame buffer means at frame boundaries.
+ */
 class writer {
 public:
     typedef std::streambuf::traits_type traits_type;
 
-    writer(std::streambuf& sb)
+    /**
+     * @brief writer encodes into @a sb, sending the strings defined in
+     * @a strings as keys, normally rap::conn::send_strings().
+     */
+    writer(std::streambuf& sb, const stringtable* strings = nullptr)
         : sb_(sb)
+        , strings_(strings)
     {
     }
 
     error write_length(size_t n) const
     {
-        if (n < 0x80) {
-            sb_.sputc(static_cast<char>(n));
+        if (n >= 0x8000)
+            return rap_err_string_too_long;
+        if (char* p = reserve(2)) {
+            commit(span_writer::put_length(p, n));
             return rap_err_ok;
         }
-        if (n < 0x8000) {
-            sb_.sputc(static_cast<char>((n >> 8) | 0x80));
-            sb_.sputc(static_cast<char>(n));
-            return rap_err_ok;
-        }
-        return rap_err_string_too_long;
+        char buf[2];
+        return put(buf, span_writer::put_length(buf, n));
     }
 
     error write_text(const char* src_ptr, size_t src_len) const
     {
-        if (!src_len) {
-            sb_.sputc(0);
-            sb_.sputc(src_ptr ? 1 : 0);
-            return rap_err_ok;
-        }
-        assert(src_ptr != NULL);
-        if (unsigned key = rap_textmap_to_key(src_ptr, src_len)) {
-            sb_.sputc(0);
-            sb_.sputc(static_cast<char>(key));
+        return write_text(src_ptr, src_len, false);
+    }
+
+    /**
+     * @brief write_header_name() writes an HTTP header name, which may
+     * be sent as the textmap key of the same name in another case.
+     */
+    error write_header_name(const char* src_ptr, size_t src_len) const
+    {
+        return write_text(src_ptr, src_len, true);
+    }
+
+    error write_text(const char* src_ptr, size_t src_len, bool header_name) const
+    {
+        if (src_len >= 0x8000)
+            return rap_err_string_too_long;
+        unsigned key;
+        size_t need = span_writer::text_size(src_ptr, src_len, key, strings_, header_name);
+        if (char* p = reserve(need)) {
+            commit(span_writer::put_text(p, src_ptr, src_len, key));
             return rap_err_ok;
         }
-        if (error e = write_length(static_cast<int16_t>(src_len)))
+        char buf[2];
+        if (!src_len || key)
+            return put(buf, span_writer::put_text(buf, src_ptr, src_len, key));
+        if (error e = put(buf, span_writer::put_length(buf, src_len)))
+            return e;
+        return put(src_ptr, src_ptr + src_len);
+    }
+
+    /**
+     * @brief write_route() writes a literal route.
+     */
+    error write_route(const char* src_ptr, size_t src_len) const
+    {
+        if (error e = write_length(0))
             return e;
-        const char* src_end = src_ptr + src_len;
-        while (src_ptr < src_end)
-            if (sb_.sputc(*src_ptr++) == traits_type::eof()) {
-                assert(0);
-                return rap_err_output_buffer_too_small;
-            }
+        return write_text(src_ptr, src_len);
+    }
+
+    /**
+     * @brief write_route() writes a route by its template @a index from
+     * rap::muxer::define_route(), followed by one parameter for each
+     * placeholder in the template.
+     */
+    error write_route(uint16_t index, const text* params, size_t count) const
+    {
+        assert(index != 0);
+        if (error e = write_length(index))
+            return e;
+        for (size_t i = 0; i < count; ++i) {
+            size_t len = params[i].size();
+            if (error e = write_length(len))
+                return e;
+            if (error e = put(params[i].data(), params[i].data() + len))
+                return e;
+        }
         return rap_err_ok;
     }
 
+    /**
+     * @brief write() copies already encoded bytes.
+     */
+    error write(const char* src_ptr, size_t src_len) const
+    {
+        return put(src_ptr, src_ptr + src_len);
+    }
+
     void write_uint64(uint64_t n) const
     {
-        while (n >= 0x80) {
-            sb_.sputc(static_cast<char>((n & 0x7f) | 0x80));
-            n >>= 7;
+        if (char* p = reserve(10)) {
+            commit(span_writer::put_uint64(p, n));
+            return;
         }
-        sb_.sputc(static_cast<char>(n & 0x7f));
+        char buf[10];
+        put(buf, span_writer::put_uint64(buf, n));
     }
 
     // single char
@@ -88,10 +298,7 @@ public:
 
     const rap::writer& operator<<(int64_t n) const
     {
-        uint64_t ux = static_cast<uint64_t>(n) << 1;
-        if (n < 0)
-            ux = ~ux;
-        write_uint64(ux);
+        write_uint64(span_writer::zigzag(n));
         return *this;
     }
 
@@ -109,6 +316,35 @@ public:
 
 private:
     std::streambuf& sb_;
+    const stringtable* strings_;
+
+    // exposes the protected put area members of any streambuf
+    struct putarea : std::streambuf {
+        static char* ptr(std::streambuf& sb) { return (sb.*&putarea::pptr)(); }
+        static char* end(std::streambuf& sb) { return (sb.*&putarea::epptr)(); }
+        static void bump(std::streambuf& sb, int n) { (sb.*&putarea::pbump)(n); }
+    };
+
+    // returns where n bytes can be written directly, or nullptr
+    char* reserve(size_t n) const
+    {
+        char* p = putarea::ptr(sb_);
+        if (p != nullptr && static_cast<size_t>(putarea::end(sb_) - p) >= n)
+            return p;
+        return nullptr;
+    }
+
+    void commit(char* p) const { putarea::bump(sb_, static_cast<int>(p - putarea::ptr(sb_))); }
+
+    error put(const char* src_ptr, const char* src_end) const
+    {
+        std::streamsize n = static_cast<std::streamsize>(src_end - src_ptr);
+        if (sb_.sputn(src_ptr, n) != n) {
+            assert(0);
+            return rap_err_output_buffer_too_small;
+        }
+        return rap_err_ok;
+    }
 };
 
 } // namespace rap
@@ -0,0 +1,184 @@
+/**
+ * @brief Send window benchmark
+ *
+ * Runs two muxers against each other over an in-process pipe that delays
+ * everything written by half the round-trip time, and prints the throughput
+ * of one connection sending 16 KiB frames for several round-trip times,
+ * with a fixed window of rap_max_send_window frames and with the adaptive
+ * rap::window allowed up to rap_max_send_window_limit frames.
+ *
+ * Usage: bench_window [seconds per run]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <thread>
+
+#include "rap.hpp"
+#include "rap_conn.hpp"
+#include "rap_muxer.hpp"
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+enum {
+    frame_payload_size = 0x4000,
+    max_queued_frames = 256,
+    bench_conn_id = 1
+};
+
+// one direction of the link, delivering what is written after a delay
+struct pipe {
+    struct chunk {
+        clock_type::time_point due;
+        std::string data;
+    };
+
+    rap::muxer* to;
+    clock_type::duration delay;
+    std::deque<chunk> chunks;
+
+    bool deliver(clock_type::time_point now)
+    {
+        bool delivered = false;
+        while (!chunks.empty() && chunks.front().due <= now) {
+            chunk c;
+            c.data.swap(chunks.front().data);
+            chunks.pop_front();
+            if (to->recv(c.data.data(), static_cast<int>(c.data.size())) < 0) {
+                fprintf(stderr, "bench_window: recv failed\n");
+                exit(1);
+            }
+            delivered = true;
+        }
+        return delivered;
+    }
+};
+
+struct receiver {
+    uint64_t frames;
+    uint64_t bytes;
+};
+
+int pipe_write(void* user_data, const char* p, int n)
+{
+    pipe* pp = static_cast<pipe*>(user_data);
+    pipe::chunk c;
+    c.due = clock_type::now() + pp->delay;
+    c.data.assign(p, static_cast<size_t>(n));
+    pp->chunks.push_back(c);
+    return 0;
+}
+
+int recv_frame(void* conn_cb_param, rap_conn*, const rap_frame* f, int)
+{
+    receiver* r = static_cast<receiver*>(conn_cb_param);
+    if (f->header().has_body()) {
+        ++r->frames;
+        r->bytes += f->payload_size();
+    }
+    return 0;
+}
+
+receiver* the_receiver;
+
+void conn_init(void*, rap_conn_id, rap_conn* conn)
+{
+    static_cast<rap::conn*>(conn)->set_callback(recv_frame, the_receiver);
+}
+
+struct result {
+    double mbytes_per_sec;
+    int window;
+};
+
+result run(clock_type::duration rtt, bool adaptive, clock_type::duration length)
+{
+    receiver r = { 0, 0 };
+    the_receiver = &r;
+    pipe ab, ba;
+    rap::muxer a(&ab, pipe_write, nullptr);
+    rap::muxer b(&ba, pipe_write, conn_init);
+    ab.to = &b;
+    ab.delay = rtt / 2;
+    ba.to = &a;
+    ba.delay = rtt / 2;
+
+    rap::window_limits limits;
+    limits.max_frames = rap_max_send_window_limit;
+    b.set_window_limits(limits);
+    if (!adaptive)
+        limits.min_frames = limits.max_frames = rap_max_send_window;
+    a.set_window_limits(limits);
+
+    // let the setup frames cross before timing anything
+    b.send_setup();
+    while (!ab.chunks.empty() || !ba.chunks.empty()) {
+        std::this_thread::sleep_for(rtt / 4);
+        clock_type::time_point now = clock_type::now();
+        ab.deliver(now);
+        ba.deliver(now);
+    }
+
+    std::string buf(rap_frame_header_size + frame_payload_size, 'x');
+    rap_frame* f = reinterpret_cast<rap_frame*>(&buf[0]);
+    f->header() = rap_header(bench_conn_id);
+    f->header().set_body();
+    f->header().set_size_value(frame_payload_size);
+    rap::conn* c = a.get_conn(bench_conn_id);
+
+    uint64_t written = 0;
+    clock_type::time_point start = clock_type::now();
+    clock_type::time_point end = start + length;
+    for (;;) {
+        while (written - r.frames < max_queued_frames) {
+            c->write_frame(f);
+            ++written;
+        }
+        clock_type::time_point now = clock_type::now();
+        if (now >= end)
+            break;
+        bool delivered = ab.deliver(now);
+        delivered |= ba.deliver(now);
+        if (!delivered) {
+            clock_type::time_point next = end;
+            if (!ab.chunks.empty() && ab.chunks.front().due < next)
+                next = ab.chunks.front().due;
+            if (!ba.chunks.empty() && ba.chunks.front().due < next)
+                next = ba.chunks.front().due;
+            std::this_thread::sleep_until(next);
+        }
+    }
+    double secs = std::chrono::duration<double>(clock_type::now() - start).count();
+    result res = { static_cast<double>(r.bytes) / secs / 1e6, c->window().size() };
+    return res;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    double secs = argc > 1 ? atof(argv[1]) : 2.0;
+    if (secs <= 0) {
+        fprintf(stderr, "usage: bench_window [seconds per run]\n");
+        return 2;
+    }
+    clock_type::duration length = std::chrono::duration_cast<clock_type::duration>(
+        std::chrono::duration<double>(secs));
+
+    static const int rtts_usec[] = { 200, 1000, 5000, 20000, 50000 };
+    printf("%8s %14s %14s %8s\n", "rtt ms", "fixed MB/s", "adaptive MB/s", "window");
+    for (size_t i = 0; i < sizeof(rtts_usec) / sizeof(rtts_usec[0]); ++i) {
+        clock_type::duration rtt = std::chrono::microseconds(rtts_usec[i]);
+        result fixed = run(rtt, false, length);
+        result adaptive = run(rtt, true, length);
+        printf("%8.1f %14.1f %14.1f %8d\n", rtts_usec[i] / 1000.0,
+            fixed.mbytes_per_sec, adaptive.mbytes_per_sec, adaptive.window);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+/**
+ * @brief Writer benchmark
+ *
+ * Encodes a typical request head over and over, with rap::span_writer into
+ * plain memory, with rap::writer into a streambuf put area, and with the
+ * one sputc() per byte encoding rap::writer used before, and prints the
+ * time per record for each.
+ *
+ * Usage: bench_writer [records]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "rap.hpp"
+#include "rap_writer.hpp"
+#include "sputc_writer.hpp"
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+// a put area that is rewound for each record, like a frame buffer
+class frame_buf : public std::streambuf {
+public:
+    frame_buf()
+        : area_(0x10000)
+    {
+        rewind();
+    }
+
+    void rewind() { setp(&area_[0], &area_[0] + area_.size()); }
+    size_t size() const { return static_cast<size_t>(pptr() - pbase()); }
+
+private:
+    std::vector<char> area_;
+};
+
+struct header {
+    const char* name;
+    const char* value;
+};
+
+const header headers[] = {
+    { "Host", "api.example.com" },
+    { "User-Agent", "Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/118.0" },
+    { "Accept", "application/json" },
+    { "Accept-Encoding", "gzip, deflate, br" },
+    { "Accept-Language", "en-US,en;q=0.5" },
+    { "Cookie", "session=8d5e957f297893487bd98fa830fa6413; theme=dark" },
+    { "X-Request-Id", "7f0c1a52-3c7e-4d3b-9a50-2f6b1d0a9e11" },
+    { "Cache-Control", "no-cache" },
+};
+
+// the fields of a request record, in the order rap::request writes them
+template <typename Writer>
+void encode(Writer& w)
+{
+    w.write_text("GET", 3, false);
+    w.write_text("https", 5, false);
+    w.write_length(0);
+    w.write_text("/api/v1/users/12345/profile", 27, false);
+    w.write_text("fields", 6, false);
+    w.write_text("name,email,avatar", 17, false);
+    w.write_text(nullptr, 0, false);
+    for (size_t i = 0; i < sizeof(headers) / sizeof(headers[0]); ++i) {
+        w.write_text(headers[i].name, strlen(headers[i].name), true);
+        w.write_text(headers[i].value, strlen(headers[i].value), false);
+    }
+    w.write_text(nullptr, 0, false);
+    w.write_text("api.example.com", 15, false);
+    w.write_uint64(rap::span_writer::zigzag(-1));
+}
+
+template <typename F>
+void run(const char* name, long records, F f)
+{
+    clock_type::time_point start = clock_type::now();
+    size_t bytes = 0;
+    for (long i = 0; i < records; ++i)
+        bytes += f();
+    double secs = std::chrono::duration<double>(clock_type::now() - start).count();
+    printf("%-12s %8.1f ns/record %8.1f MB/s\n", name, secs * 1e9 / static_cast<double>(records),
+        static_cast<double>(bytes) / secs / 1e6);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    long records = argc > 1 ? atol(argv[1]) : 2000000;
+    if (records <= 0) {
+        fprintf(stderr, "usage: bench_writer [records]\n");
+        return 2;
+    }
+
+    std::vector<char> mem(0x10000);
+    frame_buf sb;
+    run("span_writer", records, [&]() {
+        rap::span_writer w(&mem[0], &mem[0] + mem.size());
+        encode(w);
+        return static_cast<size_t>(w.data() - &mem[0]);
+    });
+    run("writer", records, [&]() {
+        sb.rewind();
+        rap::writer w(sb);
+        encode(w);
+        return sb.size();
+    });
+    run("sputc", records, [&]() {
+        sb.rewind();
+        sputc_writer w(sb);
+        encode(w);
+        return sb.size();
+    });
+    return 0;
+}
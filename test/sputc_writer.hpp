@@ -0,0 +1,79 @@
+#ifndef SPUTC_WRITER_HPP
+#define SPUTC_WRITER_HPP
+
+#include <cstdint>
+#include <streambuf>
+
+#include "rap.hpp"
+#include "rap_writer.hpp"
+
+/**
+ * @brief sputc_writer encodes like rap::writer, one sputc() per byte, the
+ * way rap::writer did before it wrote into the put area. The tests and
+ * benchmarks compare the two.
+ */
+class sputc_writer {
+public:
+    sputc_writer(std::streambuf& sb, const rap::stringtable* strings = nullptr)
+        : sb_(sb)
+        , strings_(strings)
+    {
+    }
+
+    rap::error write_length(size_t n) const
+    {
+        if (n < 0x80) {
+            sb_.sputc(static_cast<char>(n));
+            return rap::rap_err_ok;
+        }
+        if (n < 0x8000) {
+            sb_.sputc(static_cast<char>((n >> 8) | 0x80));
+            sb_.sputc(static_cast<char>(n));
+            return rap::rap_err_ok;
+        }
+        return rap::rap_err_string_too_long;
+    }
+
+    rap::error write_text(const char* src_ptr, size_t src_len, bool header_name = false) const
+    {
+        if (!src_len) {
+            sb_.sputc(0);
+            sb_.sputc(src_ptr ? 1 : 0);
+            return rap::rap_err_ok;
+        }
+        unsigned key;
+        rap::span_writer::text_size(src_ptr, src_len, key, strings_, header_name);
+        if (key) {
+            sb_.sputc(0);
+            sb_.sputc(static_cast<char>(key));
+            return rap::rap_err_ok;
+        }
+        if (rap::error e = write_length(src_len))
+            return e;
+        return write(src_ptr, src_len);
+    }
+
+    rap::error write(const char* src_ptr, size_t src_len) const
+    {
+        const char* src_end = src_ptr + src_len;
+        while (src_ptr < src_end)
+            if (sb_.sputc(*src_ptr++) == std::streambuf::traits_type::eof())
+                return rap::rap_err_output_buffer_too_small;
+        return rap::rap_err_ok;
+    }
+
+    void write_uint64(uint64_t n) const
+    {
+        while (n >= 0x80) {
+            sb_.sputc(static_cast<char>((n & 0x7f) | 0x80));
+            n >>= 7;
+        }
+        sb_.sputc(static_cast<char>(n & 0x7f));
+    }
+
+private:
+    std::streambuf& sb_;
+    const rap::stringtable* strings_;
+};
+
+#endif // SPUTC_WRITER_HPP
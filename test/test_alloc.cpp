@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "rap.hpp"
+#include "rap_frame.h"
+#include "rap_reader.hpp"
+#include "rap_record.hpp"
+#include "rap_request.hpp"
+#include "rap_writer.hpp"
+
+// counts the allocations made through operator new
+static size_t allocations;
+
+void* operator new(size_t n)
+{
+    ++allocations;
+    if (void* p = malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t n)
+{
+    ++allocations;
+    if (void* p = malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+
+namespace {
+
+const char* const header_values[][2] = {
+    { "Host", "api.example.com" },
+    { "User-Agent", "test" },
+    { "Accept", "application/json" },
+    { "Accept-Encoding", "gzip" },
+    { "Accept-Language", "en" },
+    { "Cookie", "session=1" },
+    { "X-Request-Id", "42" },
+    { "Cache-Control", "no-cache" },
+    { "X-Forwarded-For", "10.0.0.1" },
+};
+
+// encodes a request with a query of two parameters and @a num_headers headers
+std::vector<char> request_frame(size_t num_headers)
+{
+    std::vector<char> buf(rap_frame_max_size);
+    rap_frame* f = reinterpret_cast<rap_frame*>(&buf[0]);
+    rap::span_writer w(f->payload(), &buf[0] + buf.size());
+    char tag = static_cast<char>(rap::record::tag_http_request);
+    w.write(&tag, 1);
+    w.write_text("GET", 3);
+    w.write_text("https", 5);
+    w.write_length(0);
+    w.write_text("/users/42", 9);
+    w.write_text("fields", 6);
+    w.write_text("name", 4);
+    w.write_text(nullptr, 0);
+    w.write_text("page", 4);
+    w.write_text("2", 1);
+    w.write_text(nullptr, 0);
+    w.write_text(nullptr, 0);
+    for (size_t i = 0; i < num_headers; ++i) {
+        w.write_header_name(header_values[i][0], strlen(header_values[i][0]));
+        w.write_text(header_values[i][1], strlen(header_values[i][1]));
+        w.write_text(nullptr, 0);
+    }
+    w.write_text(nullptr, 0);
+    w.write_text("api.example.com", 15);
+    w.write_int64(-1);
+    f->header() = rap_header(1);
+    f->header().set_head();
+    f->header().set_size_value(static_cast<size_t>(w.data() - f->payload()));
+    return buf;
+}
+
+// decodes the request in @a buf, returning the allocations made
+size_t decode(const std::vector<char>& buf, size_t num_headers)
+{
+    size_t before = allocations;
+    rap::reader r(reinterpret_cast<const rap_frame*>(&buf[0]));
+    EXPECT_EQ(rap::record::tag_http_request, r.read_tag());
+    rap::request req(r);
+    size_t count = allocations - before;
+    EXPECT_EQ(rap::rap_err_ok, r.error());
+    EXPECT_EQ(6u, req.query().size());
+    EXPECT_EQ(num_headers * 3, req.headers().size());
+    EXPECT_EQ(1u, req.headers().find("Host"));
+    return count;
+}
+
+} // namespace
+
+static_assert(rap::kvv::inline_size == 24, "the tests below assume 8 headers fit inline");
+
+TEST(alloc, request_with_eight_headers_does_not_allocate)
+{
+    std::vector<char> buf(request_frame(8));
+    EXPECT_EQ(0u, decode(buf, 8));
+}
+
+TEST(alloc, ninth_header_allocates)
+{
+    std::vector<char> buf(request_frame(9));
+    EXPECT_GT(decode(buf, 9), 0u);
+}
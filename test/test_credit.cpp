@@ -0,0 +1,199 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "rap.hpp"
+#include "rap_conn.hpp"
+#include "rap_muxer.hpp"
+
+namespace {
+
+enum {
+    payload_size = 0x4000,
+    frame_size = rap_frame_header_size + payload_size,
+    window_size = 0x40000
+};
+
+// a muxer whose output is collected until delivered to another peer
+struct peer {
+    peer()
+        : m(this, on_write, on_conn_init)
+        , frames(0)
+        , next_id_(0)
+    {
+    }
+
+    rap::muxer m;
+    std::string out;
+    int frames;
+
+    static int on_write(void* p, const char* buf, int n)
+    {
+        static_cast<peer*>(p)->out.append(buf, static_cast<size_t>(n));
+        return 0;
+    }
+
+    static int on_frame(void* p, rap_conn*, const rap_frame* f, int)
+    {
+        if (f->header().has_body())
+            static_cast<peer*>(p)->frames++;
+        return 0;
+    }
+
+    static void on_conn_init(void* p, rap_conn_id, rap_conn* c)
+    {
+        static_cast<rap::conn*>(c)->set_callback(on_frame, p);
+    }
+
+    // writes @a n frames, a few per connection to stay inside their windows
+    void write_frames(int n)
+    {
+        std::string buf(frame_size, 'x');
+        rap_frame* f = reinterpret_cast<rap_frame*>(&buf[0]);
+        for (int i = 0; i < n; ++i) {
+            rap_conn_id id = static_cast<rap_conn_id>(next_id_++ / 4 + 1);
+            f->header() = rap_header(id);
+            f->header().set_body();
+            f->header().set_size_value(payload_size);
+            m.get_conn(id)->write_frame(f);
+        }
+    }
+
+    // receives a setup frame advertising a link window of @a n bytes
+    void recv_setup(uint64_t n)
+    {
+        char buf[rap_frame_header_size + 12];
+        char* p = buf + rap_frame_header_size;
+        *p++ = static_cast<char>(rap::rap_frame_type_setup);
+        *p++ = static_cast<char>(rap_max_send_window);
+        for (; n >= 0x80; n >>= 7)
+            *p++ = static_cast<char>((n & 0x7f) | 0x80);
+        *p++ = static_cast<char>(n);
+        rap_frame* f = reinterpret_cast<rap_frame*>(buf);
+        f->header() = rap_header(rap_muxer_conn_id);
+        f->header().set_head();
+        f->header().set_size_value(static_cast<size_t>(p - f->payload()));
+        m.recv(buf, static_cast<int>(p - buf));
+    }
+
+private:
+    int next_id_;
+};
+
+void deliver(peer& from, peer& to)
+{
+    std::string s;
+    s.swap(from.out);
+    to.m.recv(s.data(), static_cast<int>(s.size()));
+}
+
+// bytes of connection frames that count against the link window
+size_t data_bytes(const std::string& s)
+{
+    size_t n = 0;
+    for (size_t i = 0; i + rap_frame_header_size <= s.size();) {
+        const rap_header* h = reinterpret_cast<const rap_header*>(s.data() + i);
+        if (h->id() != rap_muxer_conn_id && !h->is_flow())
+            n += h->size();
+        i += h->size();
+    }
+    return n;
+}
+
+// sets up @a b to grant @a a a link window of window_size bytes
+void handshake(peer& a, peer& b)
+{
+    b.m.set_link_window(window_size);
+    b.m.send_setup();
+    deliver(b, a);
+    deliver(a, b);
+}
+
+} // namespace
+
+TEST(credit, limits_bytes_in_flight)
+{
+    peer a, b;
+    handshake(a, b);
+    a.write_frames(64);
+    size_t sent = data_bytes(a.out);
+    EXPECT_GE(sent, static_cast<size_t>(window_size));
+    EXPECT_LT(sent, static_cast<size_t>(window_size + frame_size));
+
+    // the credit returned lets the rest through
+    for (int i = 0; i < 20 && b.frames < 64; ++i) {
+        deliver(a, b);
+        deliver(b, a);
+    }
+    EXPECT_EQ(64, b.frames);
+}
+
+TEST(credit, counts_bytes_sent_before_setup)
+{
+    peer a, b;
+    a.write_frames(8);
+    size_t early = data_bytes(a.out);
+    EXPECT_EQ(static_cast<size_t>(8 * frame_size), early);
+
+    // the frames already sent are in flight when the window arrives
+    b.m.set_link_window(window_size);
+    b.m.send_setup();
+    deliver(b, a);
+    a.write_frames(64);
+    EXPECT_LT(data_bytes(a.out), static_cast<size_t>(window_size + frame_size));
+
+    for (int i = 0; i < 20 && b.frames < 72; ++i) {
+        deliver(a, b);
+        deliver(b, a);
+    }
+    EXPECT_EQ(72, b.frames);
+}
+
+TEST(credit, repeated_setup_keeps_bytes_in_flight)
+{
+    peer a, b;
+    handshake(a, b);
+    a.write_frames(64);
+    size_t sent = data_bytes(a.out);
+
+    b.m.send_setup();
+    deliver(b, a);
+    EXPECT_EQ(sent, data_bytes(a.out));
+}
+
+TEST(credit, zero_window_is_no_limit)
+{
+    peer a;
+    a.recv_setup(0);
+    a.write_frames(64);
+    EXPECT_EQ(static_cast<size_t>(64 * frame_size), data_bytes(a.out));
+}
+
+TEST(credit, setup_without_window_removes_limit)
+{
+    peer a, b;
+    handshake(a, b);
+    a.write_frames(64);
+    b.m.set_link_window(0);
+    b.m.send_setup();
+    deliver(b, a);
+    EXPECT_EQ(static_cast<size_t>(64 * frame_size), data_bytes(a.out));
+}
+
+TEST(credit, small_window_allows_a_full_frame)
+{
+    peer a;
+    a.recv_setup(1);
+    a.write_frames(64);
+    size_t sent = data_bytes(a.out);
+    EXPECT_GE(sent, static_cast<size_t>(rap_frame_max_size));
+    EXPECT_LT(sent, static_cast<size_t>(rap_frame_max_size + frame_size));
+}
+
+TEST(credit, huge_window_is_clamped)
+{
+    peer a;
+    a.recv_setup(UINT64_MAX);
+    a.write_frames(64);
+    EXPECT_EQ(static_cast<size_t>(64 * frame_size), data_bytes(a.out));
+}
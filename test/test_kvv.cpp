@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "rap.hpp"
+#include "rap_frame.h"
+#include "rap_kvv.hpp"
+#include "rap_reader.hpp"
+#include "rap_writer.hpp"
+
+namespace {
+
+// builds the frame for a kvv, where each entry is encoded as a textmap
+// key when possible unless it starts with '=', which spells it out, and
+// nullptr ends a name's values or the kvv
+class kvv_frame {
+public:
+    explicit kvv_frame(const std::vector<const char*>& entries)
+        : buf_(rap_frame_max_size)
+    {
+        rap_frame* f = frame();
+        rap::span_writer w(f->payload(), &buf_[0] + buf_.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const char* s = entries[i];
+            if (s == nullptr)
+                w.write_text(nullptr, 0);
+            else if (*s == '=') {
+                w.write_length(strlen(s + 1));
+                w.write(s + 1, strlen(s + 1));
+            } else
+                w.write_text(s, strlen(s));
+        }
+        f->header() = rap_header(1);
+        f->header().set_head();
+        f->header().set_size_value(static_cast<size_t>(w.data() - f->payload()));
+    }
+
+    rap_frame* frame() { return reinterpret_cast<rap_frame*>(&buf_[0]); }
+
+private:
+    std::vector<char> buf_;
+};
+
+unsigned key_of(const char* s) { return rap_textmap_to_key(s, strlen(s)); }
+
+} // namespace
+
+TEST(kvv, finds_textmap_name_sent_as_key)
+{
+    kvv_frame kf({ "Content-Type", "text/plain", nullptr, nullptr });
+    rap::reader r(kf.frame());
+    rap::headers h(r);
+    ASSERT_EQ(rap::rap_err_ok, r.error());
+    ASSERT_NE(0u, h.at(0).key());
+    EXPECT_EQ(1u, h.find("Content-Type"));
+    EXPECT_EQ(1u, h.find(key_of("Content-Type")));
+}
+
+TEST(kvv, finds_textmap_name_spelled_out)
+{
+    kvv_frame kf({ "=X-Custom", "1", nullptr, "=Content-Type", "text/plain", nullptr, nullptr });
+    rap::reader r(kf.frame());
+    rap::headers h(r);
+    ASSERT_EQ(rap::rap_err_ok, r.error());
+    ASSERT_EQ(0u, h.at(3).key());
+    EXPECT_EQ(1u, h.find("X-Custom"));
+    EXPECT_EQ(4u, h.find("Content-Type"));
+    EXPECT_EQ(4u, h.find(key_of("Content-Type")));
+    EXPECT_EQ(0u, h.find("Host"));
+}
+
+TEST(kvv, finds_first_of_spelled_out_and_key)
+{
+    kvv_frame kf({ "=Host", "a", nullptr, "Host", "b", nullptr, nullptr });
+    rap::reader r(kf.frame());
+    rap::headers h(r);
+    ASSERT_EQ(rap::rap_err_ok, r.error());
+    EXPECT_EQ(1u, h.find("Host"));
+}
+
+TEST(kvv, index_finds_textmap_name_spelled_out)
+{
+    std::vector<const char*> entries;
+    static const char* names[] = { "=x-a", "=x-b", "=x-c", "=x-d", "=x-e", "=x-f", "=x-g", "=x-h" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        entries.push_back(names[i]);
+        entries.push_back("v");
+        entries.push_back(nullptr);
+    }
+    entries.push_back("=Content-Type");
+    entries.push_back("text/plain");
+    entries.push_back(nullptr);
+    entries.push_back("User-Agent");
+    entries.push_back("test");
+    entries.push_back(nullptr);
+    entries.push_back(nullptr);
+    kvv_frame kf(entries);
+    rap::reader r(kf.frame());
+    rap::headers h(r);
+    ASSERT_EQ(rap::rap_err_ok, r.error());
+
+    // the first miss builds the index
+    EXPECT_EQ(0u, h.find("Host"));
+    EXPECT_EQ(25u, h.find("Content-Type"));
+    EXPECT_EQ(28u, h.find("User-Agent"));
+    EXPECT_EQ(0u, h.find("Host"));
+    EXPECT_EQ(22u, h.find("x-h"));
+}
@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "rap.hpp"
+#include "rap_stringtable.hpp"
+#include "rap_writer.hpp"
+#include "sputc_writer.hpp"
+
+namespace {
+
+// collects what is written, through a put area of the given size,
+// zero meaning none so that every byte goes through overflow()
+class capture_buf : public std::streambuf {
+public:
+    explicit capture_buf(size_t size)
+        : area_(size)
+    {
+        reset();
+    }
+
+    std::string str()
+    {
+        flush();
+        return out_;
+    }
+
+protected:
+    int_type overflow(int_type ch) override
+    {
+        flush();
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            if (area_.empty())
+                out_ += traits_type::to_char_type(ch);
+            else {
+                *pptr() = traits_type::to_char_type(ch);
+                pbump(1);
+            }
+        }
+        return traits_type::not_eof(ch);
+    }
+
+private:
+    std::vector<char> area_;
+    std::string out_;
+
+    void flush()
+    {
+        if (pptr() != pbase())
+            out_.append(pbase(), static_cast<size_t>(pptr() - pbase()));
+        reset();
+    }
+
+    void reset()
+    {
+        if (!area_.empty())
+            setp(&area_[0], &area_[0] + area_.size());
+    }
+};
+
+// writes values of every encoded size, texts sent as keys or literally,
+// and texts longer than the small put areas
+template <typename Writer>
+void encode(const Writer& w)
+{
+    static const size_t lengths[] = { 0, 1, 0x7f, 0x80, 0x1234, 0x7fff };
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+        w.write_length(lengths[i]);
+    static const uint64_t numbers[] = { 0, 1, 0x7f, 0x80, 0x3fff, 0x4000,
+        0xffffffffu, 0x8000000000000000u, 0xffffffffffffffffu };
+    for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i)
+        w.write_uint64(numbers[i]);
+    w.write_uint64(rap::span_writer::zigzag(-1));
+    w.write_uint64(rap::span_writer::zigzag(INT64_MIN));
+
+    w.write_text(nullptr, 0, false);
+    w.write_text("", 0, false);
+    w.write_text("GET", 3, false);
+    w.write_text("Content-Type", 12, true);
+    w.write_text("content-type", 12, false);
+    w.write_text("example.com", 11, false);
+    w.write_text("x-request-id", 12, true);
+    std::string big(300, 'b');
+    w.write_text(big.data(), big.size(), false);
+    std::string longest(0x7fff, 'l');
+    w.write_text(longest.data(), longest.size(), false);
+    w.write("raw", 3);
+}
+
+std::string with_writer(size_t put_area, const rap::stringtable* strings)
+{
+    capture_buf sb(put_area);
+    encode(rap::writer(sb, strings));
+    return sb.str();
+}
+
+std::string with_sputc(size_t put_area, const rap::stringtable* strings)
+{
+    capture_buf sb(put_area);
+    encode(sputc_writer(sb, strings));
+    return sb.str();
+}
+
+} // namespace
+
+TEST(writer, same_bytes_as_sputc)
+{
+    rap::stringtable strings;
+    ASSERT_NE(0u, strings.add("example.com", 11, false));
+    std::string expected = with_sputc(0, &strings);
+    ASSERT_GT(expected.size(), static_cast<size_t>(0x7fff));
+
+    static const size_t put_areas[] = { 0x10000, 0x1000, 16, 3, 2, 1, 0 };
+    for (size_t i = 0; i < sizeof(put_areas) / sizeof(put_areas[0]); ++i) {
+        EXPECT_EQ(expected, with_writer(put_areas[i], &strings)) << "put area " << put_areas[i];
+        EXPECT_EQ(expected, with_sputc(put_areas[i], &strings)) << "put area " << put_areas[i];
+    }
+}
+
+TEST(writer, same_bytes_without_strings)
+{
+    std::string expected = with_sputc(0, nullptr);
+    EXPECT_EQ(expected, with_writer(0x10000, nullptr));
+    EXPECT_EQ(expected, with_writer(3, nullptr));
+    EXPECT_EQ(expected, with_writer(0, nullptr));
+}
+
+TEST(writer, span_writer_matches)
+{
+    rap::stringtable strings;
+    strings.add("example.com", 11, false);
+    std::vector<char> buf(0x10000);
+    rap::span_writer sw(&buf[0], &buf[0] + buf.size(), &strings);
+    sw.write_text("GET", 3);
+    sw.write_text("Content-Type", 12, true);
+    sw.write_text("example.com", 11);
+    sw.write_int64(-1);
+    sw.write_length(0x1234);
+
+    capture_buf sb(0);
+    sputc_writer w(sb, &strings);
+    w.write_text("GET", 3);
+    w.write_text("Content-Type", 12, true);
+    w.write_text("example.com", 11);
+    w.write_uint64(rap::span_writer::zigzag(-1));
+    w.write_length(0x1234);
+    EXPECT_EQ(sb.str(), std::string(&buf[0], sw.data()));
+}
+
+TEST(writer, span_writer_writes_values_whole)
+{
+    char buf[4];
+    rap::span_writer sw(buf, buf + sizeof(buf));
+    EXPECT_EQ(rap::rap_err_ok, sw.write_length(0x1234));
+    EXPECT_EQ(rap::rap_err_output_buffer_too_small, sw.write_text("hello", 5));
+    EXPECT_EQ(buf + 2, sw.data());
+    EXPECT_EQ(rap::rap_err_ok, sw.write_text("x", 1));
+    EXPECT_EQ(static_cast<size_t>(0), sw.room());
+}